@@ -0,0 +1,313 @@
+#include <stdint.h>
+#include "acpi.h"
+#include "vmm.h"
+#include "stdlib.h"
+
+// Just enough acpi to find the interrupt controllers (RSDP -> RSDT -> MADT)
+// and the pm timer (FADT). Tables are mapped for the time they are read and
+// unmapped afterwards.
+
+#define BDA_EBDA_SEGMENT 0x40E
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END 0x100000
+#define EBDA_SEARCH_SIZE 1024
+
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_OVERRIDE 2
+#define MADT_LAPIC_OVERRIDE 5
+
+#define MADT_LAPIC_ENABLED 0x1
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct acpi_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_header header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed));
+
+//only the fields up to the flags, acpi 1.0 layout
+struct acpi_fadt {
+    struct acpi_header header;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t reserved;
+    uint8_t preferred_pm_profile;
+    uint16_t sci_int;
+    uint32_t smi_cmd;
+    uint8_t acpi_enable;
+    uint8_t acpi_disable;
+    uint8_t s4bios_req;
+    uint8_t pstate_cnt;
+    uint32_t pm1a_evt_blk;
+    uint32_t pm1b_evt_blk;
+    uint32_t pm1a_cnt_blk;
+    uint32_t pm1b_cnt_blk;
+    uint32_t pm2_cnt_blk;
+    uint32_t pm_tmr_blk;
+    uint32_t gpe0_blk;
+    uint32_t gpe1_blk;
+    uint8_t pm1_evt_len;
+    uint8_t pm1_cnt_len;
+    uint8_t pm2_cnt_len;
+    uint8_t pm_tmr_len;
+    uint8_t gpe0_blk_len;
+    uint8_t gpe1_blk_len;
+    uint8_t gpe1_base;
+    uint8_t cst_cnt;
+    uint16_t p_lvl2_lat;
+    uint16_t p_lvl3_lat;
+    uint16_t flush_size;
+    uint16_t flush_stride;
+    uint8_t duty_offset;
+    uint8_t duty_width;
+    uint8_t day_alrm;
+    uint8_t mon_alrm;
+    uint8_t century;
+    uint16_t iapc_boot_arch;
+    uint8_t reserved2;
+    uint32_t flags;
+} __attribute__((packed));
+
+#define FADT_TMR_VAL_EXT (1 << 8) //32 bit pm timer
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct madt_lapic {
+    struct madt_entry entry;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+    struct madt_entry entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_override {
+    struct madt_entry entry;
+    uint8_t bus;
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed));
+
+struct madt_lapic_override {
+    struct madt_entry entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+struct acpi_madt_info acpi_madt;
+struct acpi_fadt_info acpi_fadt;
+
+static uint8_t acpi_checksum(const void *data, uint32_t len) {
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        sum += ((const uint8_t *)data)[i];
+    }
+
+    return sum;
+}
+
+static physaddr_t acpi_scan_rsdp(const uint8_t *area, uint32_t len) {
+    for (uint32_t offset = 0; offset + sizeof(struct acpi_rsdp) <= len; offset += 16) {
+        if (memcmp(area + offset, "RSD PTR ", 8) == 0 && acpi_checksum(area + offset, sizeof(struct acpi_rsdp)) == 0) {
+            return ((const struct acpi_rsdp *)(area + offset))->rsdt_address;
+        }
+    }
+
+    return (0);
+}
+
+//the rsdp is in the first KB of the ebda or in the bios rom area
+static physaddr_t acpi_find_rsdt(void) {
+    physaddr_t rsdt = 0;
+    uint8_t *low = vmm_map_phys(0, 0, PAGE_SIZE, VM_MAP_KERNEL);
+
+    if (low != (void *)0) {
+        physaddr_t ebda = (physaddr_t)*(uint16_t *)(low + BDA_EBDA_SEGMENT) << 4;
+        vmm_unmap_phys(low);
+
+        if (ebda != 0) {
+            uint8_t *area = vmm_map_phys(0, ebda, EBDA_SEARCH_SIZE, VM_MAP_KERNEL);
+            if (area != (void *)0) {
+                rsdt = acpi_scan_rsdp(area, EBDA_SEARCH_SIZE);
+                vmm_unmap_phys(area);
+            }
+        }
+    }
+
+    if (rsdt == 0) {
+        uint8_t *area = vmm_map_phys(0, BIOS_AREA_START, BIOS_AREA_END - BIOS_AREA_START, VM_MAP_KERNEL);
+        if (area != (void *)0) {
+            rsdt = acpi_scan_rsdp(area, BIOS_AREA_END - BIOS_AREA_START);
+            vmm_unmap_phys(area);
+        }
+    }
+
+    return rsdt;
+}
+
+//map a whole table once its length is known, 0 if it is broken
+static struct acpi_header *acpi_map_table(physaddr_t phys) {
+    struct acpi_header *header = vmm_map_phys(0, phys, sizeof(struct acpi_header), VM_MAP_KERNEL);
+    if (header == (void *)0) {
+        return (void *)0;
+    }
+
+    uint32_t length = header->length;
+    vmm_unmap_phys(header);
+
+    if (length < sizeof(struct acpi_header)) {
+        return (void *)0;
+    }
+
+    header = vmm_map_phys(0, phys, length, VM_MAP_KERNEL);
+    if (header != (void *)0 && acpi_checksum(header, length) != 0) {
+        vmm_unmap_phys(header);
+        return (void *)0;
+    }
+
+    return header;
+}
+
+static void acpi_parse_madt(const struct acpi_madt *madt) {
+    const uint8_t *p = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+    acpi_madt.lapic_address = madt->lapic_address;
+    acpi_madt.flags = madt->flags;
+
+    while (p + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry *entry = (const struct madt_entry *)p;
+        if (entry->length < sizeof(struct madt_entry) || p + entry->length > end) {
+            break;
+        }
+
+        switch (entry->type) {
+            case MADT_LAPIC: {
+                const struct madt_lapic *lapic = (const struct madt_lapic *)entry;
+                if ((lapic->flags & MADT_LAPIC_ENABLED) && acpi_madt.cpu_count < ACPI_MAX_CPUS) {
+                    acpi_madt.cpu_apic_ids[acpi_madt.cpu_count++] = lapic->apic_id;
+                }
+                break;
+            }
+
+            case MADT_IOAPIC: {
+                const struct madt_ioapic *ioapic = (const struct madt_ioapic *)entry;
+                if (acpi_madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                    struct acpi_ioapic *info = &acpi_madt.ioapics[acpi_madt.ioapic_count++];
+                    info->id = ioapic->id;
+                    info->address = ioapic->address;
+                    info->gsi_base = ioapic->gsi_base;
+                }
+                break;
+            }
+
+            case MADT_OVERRIDE: {
+                const struct madt_override *override = (const struct madt_override *)entry;
+                if (override->bus == 0 && acpi_madt.override_count < ACPI_MAX_OVERRIDES) {
+                    struct acpi_override *info = &acpi_madt.overrides[acpi_madt.override_count++];
+                    info->irq = override->irq;
+                    info->gsi = override->gsi;
+                    info->flags = override->flags;
+                }
+                break;
+            }
+
+            case MADT_LAPIC_OVERRIDE: {
+                const struct madt_lapic_override *override = (const struct madt_lapic_override *)entry;
+                if ((override->address >> 32) == 0) {
+                    acpi_madt.lapic_address = override->address;
+                }
+                break;
+            }
+        }
+
+        p += entry->length;
+    }
+}
+
+static void acpi_parse_fadt(const struct acpi_fadt *fadt) {
+    if (fadt->header.length < sizeof(struct acpi_fadt) || fadt->pm_tmr_len != 4) {
+        return;
+    }
+
+    acpi_fadt.pm_timer_port = fadt->pm_tmr_blk;
+    acpi_fadt.pm_timer_32bit = (fadt->flags & FADT_TMR_VAL_EXT) != 0;
+}
+
+int acpi_init() {
+    memset(&acpi_madt, 0, sizeof(acpi_madt));
+    memset(&acpi_fadt, 0, sizeof(acpi_fadt));
+
+    physaddr_t rsdt_phys = acpi_find_rsdt();
+    if (rsdt_phys == 0) {
+        kprintf("acpi: no rsdp\n");
+        return (1);
+    }
+
+    struct acpi_header *rsdt = acpi_map_table(rsdt_phys);
+    if (rsdt == (void *)0) {
+        kprintf("acpi: bad rsdt at 0x%8h\n", rsdt_phys);
+        return (1);
+    }
+
+    int found = 0;
+    uint32_t entries = (rsdt->length - sizeof(struct acpi_header)) / sizeof(uint32_t);
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+
+    for (uint32_t i = 0; i < entries; i++) {
+        struct acpi_header *table = acpi_map_table(tables[i]);
+        if (table == (void *)0) {
+            continue;
+        }
+
+        if (memcmp(table->signature, "APIC", 4) == 0) {
+            acpi_parse_madt((const struct acpi_madt *)table);
+            found = 1;
+        } else if (memcmp(table->signature, "FACP", 4) == 0) {
+            acpi_parse_fadt((const struct acpi_fadt *)table);
+        }
+
+        vmm_unmap_phys(table);
+    }
+
+    vmm_unmap_phys(rsdt);
+
+    if (!found) {
+        kprintf("acpi: no madt\n");
+        return (1);
+    }
+
+    kprintf("acpi: %d cpu, %d ioapic, lapic at 0x%8h\n", acpi_madt.cpu_count, acpi_madt.ioapic_count, acpi_madt.lapic_address);
+    return (0);
+}
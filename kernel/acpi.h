@@ -0,0 +1,53 @@
+#ifndef __ACPI__
+#define __ACPI__
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_MAX_OVERRIDES 16
+
+#define ACPI_IRQ_POLARITY_MASK 0x3
+#define ACPI_IRQ_ACTIVE_LOW 0x3
+#define ACPI_IRQ_TRIGGER_MASK 0xC
+#define ACPI_IRQ_LEVEL 0xC
+
+struct acpi_ioapic {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+};
+
+//isa irq wired to another gsi, or with non default polarity/trigger
+struct acpi_override {
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+};
+
+//what we keep from the madt
+struct acpi_madt_info {
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    struct acpi_ioapic ioapics[ACPI_MAX_IOAPICS];
+    uint32_t override_count;
+    struct acpi_override overrides[ACPI_MAX_OVERRIDES];
+};
+
+#define ACPI_MADT_PCAT_COMPAT 0x1 //there is a 8259 pair to disable
+
+//what we keep from the fadt
+struct acpi_fadt_info {
+    uint32_t pm_timer_port; //0 if there is none
+    uint8_t pm_timer_32bit; //else 24 bit
+};
+
+extern struct acpi_madt_info acpi_madt;
+extern struct acpi_fadt_info acpi_fadt;
+
+int acpi_init(void);
+
+#endif
@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "vmm.h"
+#include "interrupt.h"
+#include "io.h"
+#include "stdlib.h"
+
+// Local apic (eoi, timer, ipis) and io apics (external irq routing),
+// found through the acpi madt. Without them the 8259 pair stays in use.
+
+#define MSR_APIC_BASE 0x1B
+#define MSR_APIC_BASE_ENABLE 0x800
+
+#define LAPIC_SPURIOUS_ENABLE 0x100
+
+#define IOAPIC_REGSEL 0
+#define IOAPIC_WINDOW 4 //in dwords
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10
+
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL (1 << 15)
+#define IOAPIC_MASKED (1 << 16)
+
+struct ioapic {
+    volatile uint32_t *base;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+};
+
+volatile uint32_t *lapic_base = (void *)0;
+uint8_t apic_enabled = 0;
+
+static struct ioapic ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+static uint32_t ioapic_read(struct ioapic *ioapic, uint8_t reg) {
+    ioapic->base[IOAPIC_REGSEL] = reg;
+    return ioapic->base[IOAPIC_WINDOW];
+}
+
+static void ioapic_write(struct ioapic *ioapic, uint8_t reg, uint32_t value) {
+    ioapic->base[IOAPIC_REGSEL] = reg;
+    ioapic->base[IOAPIC_WINDOW] = value;
+}
+
+static struct ioapic *ioapic_for_gsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count) {
+            return &ioapics[i];
+        }
+    }
+
+    return (void *)0;
+}
+
+//isa irqs are edge/active high on their own number unless the madt says otherwise
+static uint32_t irq_to_gsi(uint8_t irq, uint32_t *flags) {
+    *flags = 0;
+
+    for (uint32_t i = 0; i < acpi_madt.override_count; i++) {
+        struct acpi_override *override = &acpi_madt.overrides[i];
+        if (override->irq != irq) {
+            continue;
+        }
+
+        if ((override->flags & ACPI_IRQ_POLARITY_MASK) == ACPI_IRQ_ACTIVE_LOW) {
+            *flags |= IOAPIC_ACTIVE_LOW;
+        }
+        if ((override->flags & ACPI_IRQ_TRIGGER_MASK) == ACPI_IRQ_LEVEL) {
+            *flags |= IOAPIC_LEVEL;
+        }
+
+        return override->gsi;
+    }
+
+    return irq;
+}
+
+int ioapic_route_irq(uint8_t irq, uint8_t vector, uint8_t dest) {
+    uint32_t flags;
+    uint32_t gsi = irq_to_gsi(irq, &flags);
+    struct ioapic *ioapic = ioapic_for_gsi(gsi);
+
+    if (ioapic == (void *)0) {
+        return (1);
+    }
+
+    uint8_t reg = IOAPIC_REDIRECTION + 2 * (gsi - ioapic->gsi_base);
+    ioapic_write(ioapic, reg + 1, (uint32_t)dest << 24);
+    ioapic_write(ioapic, reg, vector | flags); //fixed delivery, physical destination, unmasked
+
+    return (0);
+}
+
+void ioapic_mask_irq(uint8_t irq, int masked) {
+    uint32_t flags;
+    uint32_t gsi = irq_to_gsi(irq, &flags);
+    struct ioapic *ioapic = ioapic_for_gsi(gsi);
+
+    if (ioapic == (void *)0) {
+        return;
+    }
+
+    uint8_t reg = IOAPIC_REDIRECTION + 2 * (gsi - ioapic->gsi_base);
+    uint32_t value = ioapic_read(ioapic, reg);
+    ioapic_write(ioapic, reg, masked ? value | IOAPIC_MASKED : value & ~IOAPIC_MASKED);
+}
+
+//per cpu part, also run by the other processors when they come up
+void lapic_setup() {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SPURIOUS, LAPIC_SPURIOUS_ENABLE | IRQ_SPURIOUS);
+}
+
+//fixed vector or init/startup command to one processor
+void lapic_send_ipi(uint8_t apic_id, uint32_t command) {
+    unsigned int flags = irq_save();
+
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+
+    irq_restore(flags);
+}
+
+int apic_init() {
+    if (!cpu_has(CPU_FEATURE_APIC) || acpi_madt.ioapic_count == 0) {
+        kprintf("apic: not available, staying on the 8259\n");
+        return (1);
+    }
+
+    lapic_base = vmm_map_phys(0, acpi_madt.lapic_address, PAGE_SIZE, VM_MAP_KERNEL | VM_MAP_WRITE | VM_MAP_NOCACHE);
+    if (lapic_base == (void *)0) {
+        return (1);
+    }
+
+    for (uint32_t i = 0; i < acpi_madt.ioapic_count; i++) {
+        struct ioapic *ioapic = &ioapics[ioapic_count];
+
+        ioapic->base = vmm_map_phys(0, acpi_madt.ioapics[i].address, PAGE_SIZE, VM_MAP_KERNEL | VM_MAP_WRITE | VM_MAP_NOCACHE);
+        if (ioapic->base == (void *)0) {
+            continue;
+        }
+
+        ioapic->gsi_base = acpi_madt.ioapics[i].gsi_base;
+        ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < ioapic->gsi_count; pin++) {
+            ioapic_write(ioapic, IOAPIC_REDIRECTION + 2 * pin, IOAPIC_MASKED);
+        }
+        ioapic_count++;
+    }
+
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | MSR_APIC_BASE_ENABLE);
+    lapic_setup();
+
+    apic_enabled = 1;
+    interrupt_use_apic();
+
+    kprintf("apic: lapic id %d, %d ioapic\n", lapic_id(), ioapic_count);
+    return (0);
+}
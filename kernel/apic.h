@@ -0,0 +1,55 @@
+#ifndef __APIC__
+#define __APIC__
+
+#include <stdint.h>
+
+#define LAPIC_ID 0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SPURIOUS 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_PENDING 0x1000
+#define LAPIC_ICR_ASSERT 0x4000
+#define LAPIC_ICR_LEVEL 0x8000
+
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+
+extern volatile uint32_t *lapic_base;
+extern uint8_t apic_enabled;
+
+int apic_init(void);
+void lapic_setup(void);
+void lapic_send_ipi(uint8_t apic_id, uint32_t command);
+int ioapic_route_irq(uint8_t irq, uint8_t vector, uint8_t dest);
+void ioapic_mask_irq(uint8_t irq, int masked);
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+static inline void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static inline uint8_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include "arena.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "stdlib.h"
+#include "task.h"
+
+#define BOOT_ARENA_SIZE (4 * PAGE_SIZE)
+#define SCRATCH_ARENA_SIZE (4 * PAGE_SIZE)
+
+struct arena boot_arena;
+struct arena scratch_arena;
+
+int arena_init(struct arena *arena, uint32_t size) {
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    void *base = add_vm_entry(0, size, VM_MAP_ANONYMOUS | VM_MAP_WRITE | VM_MAP_KERNEL, (void *)0, 0, 0);
+    if (base == (void *)0) {
+        return 1;
+    }
+
+    //fault every page in now: arena memory is used for dma buffers and must
+    //not page fault later (get_physaddr on it has to work)
+    memset(base, 0, size);
+
+    arena->base = (uintptr_t)base;
+    arena->size = size;
+    arena->used = 0;
+
+    return 0;
+}
+
+int arena_init_scratch(struct arena *arena) {
+    return arena_init(arena, SCRATCH_ARENA_SIZE);
+}
+
+void arena_destroy(struct arena *arena) {
+    if (arena->base != 0) {
+        rm_vm_entry((void *)arena->base);
+    }
+
+    arena->base = 0;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void *arena_alloc_aligned(struct arena *arena, uint32_t size, uint32_t align) {
+    uint32_t offset = (arena->base + arena->used + align - 1) & ~(align - 1);
+    offset -= arena->base;
+
+    if (arena->base == 0 || offset + size > arena->size || offset + size < offset) {
+        return (void *)0;
+    }
+
+    arena->used = offset + size;
+    return (void *)(arena->base + offset);
+}
+
+//per syscall / per io request temporaries. Each task has its own: one
+//may sleep in the middle of a mark/reset section (disk i/o) while another
+//one marks and resets
+struct arena *arena_scratch() {
+    struct task *task = current;
+
+    if (task != (void *)0 && task->scratch.base != 0) {
+        return &task->scratch;
+    }
+
+    return &scratch_arena;
+}
+
+void arena_setup() {
+    if (arena_init(&boot_arena, BOOT_ARENA_SIZE) != 0) {
+        kprintf("ERROR: arena_setup: boot arena\n");
+    }
+
+    if (arena_init(&scratch_arena, SCRATCH_ARENA_SIZE) != 0) {
+        kprintf("ERROR: arena_setup: scratch arena\n");
+    }
+}
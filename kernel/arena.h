@@ -0,0 +1,41 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <stdint.h>
+
+//bump allocator over a pre-faulted kernel region. memory is handed out
+//linearly and given back all at once with arena_reset to an earlier mark.
+struct arena {
+    uintptr_t base;
+    uint32_t size;
+    uint32_t used;
+};
+
+typedef uint32_t arena_mark_t;
+
+#define ARENA_ALIGN 8
+#define ARENA_SECTOR_ALIGN 512 //a sector buffer aligned like this never crosses a page (dma)
+
+extern struct arena boot_arena;    //permanent boot time data, never reset
+extern struct arena scratch_arena; //the boot context's and idle tasks' temporaries
+
+int arena_init(struct arena *arena, uint32_t size);
+int arena_init_scratch(struct arena *arena);
+void arena_destroy(struct arena *arena);
+void *arena_alloc_aligned(struct arena *arena, uint32_t size, uint32_t align);
+void arena_setup(void);
+struct arena *arena_scratch(void);
+
+static inline void *arena_alloc(struct arena *arena, uint32_t size) {
+    return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+static inline arena_mark_t arena_mark(struct arena *arena) {
+    return arena->used;
+}
+
+static inline void arena_reset(struct arena *arena, arena_mark_t mark) {
+    arena->used = mark;
+}
+
+#endif
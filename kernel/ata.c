@@ -144,7 +144,7 @@ unsigned static char atapi_packet[12] = {0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 extern void sleep(unsigned int t);
 
-void ide_int(unsigned int intno, void *ext);
+int ide_int(unsigned int intno, void *ext);
 static enum ata_dma_support ata_detect_dma(void);
 
 static unsigned char ide_read(unsigned char channel, unsigned char reg) {
@@ -392,7 +392,14 @@ static int ide_read_sectors(void *bdev, uint8_t numsects, uint32_t lba, void *ed
 	return 4;
 }
 
-void ide_int(unsigned int intno, void *ext) {
+int ide_int(unsigned int intno, void *ext) {
+	unsigned char channel = intno == 0x2e ? ATA_PRIMARY : ATA_SECONDARY;
+
+	//bit 2 of the bus master status: this channel raised the line
+	if ((ide_read(channel, ATA_BMR_STATUS) & 0x4) == 0) {
+		return IRQ_NONE;
+	}
+
 	ide_irq_invoked++;
 
 	if (intno == 0x2e) {
@@ -404,6 +411,8 @@ void ide_int(unsigned int intno, void *ext) {
 		//kprintf("secodary ide master bus status: 0x%2h;\n", ide_read(ATA_SECONDARY, ATA_BMR_STATUS));
 		ide_write(ATA_SECONDARY, ATA_BMR_STATUS, 0x4);
 	}
+
+	return IRQ_HANDLED;
 }
 
 
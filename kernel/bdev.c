@@ -1,72 +1,194 @@
 #include "bdev.h"
 #include "fat.h"
 #include "mbr.h"
+#include "lock.h"
+#include "rcu.h"
+#include "liballoc.h"
 
-struct {
-    uint8_t reserved;
+// Both tables are read on every i/o and almost never change: readers go
+// through rcu, updaters (under bdev_lock) publish a new version and free
+// the old one after a grace period. The operations may sleep, so readers
+// copy what they need and call it outside of the read side section.
+
+#define BDEV_MAX 8
+
+struct bdev_entry {
     struct bdev_operation *ops;
     void *bdev;
-} bdev[8];
+    struct rcu_head rcu;
+};
 
-typedef enum bdev_payload_status (*bdev_payload_init)(uint8_t device);
-bdev_payload_init payloads[] = {
-    mbr_init,
-    fat_init,
+struct bdev_payloads {
+    struct rcu_head rcu;
+    uint32_t count;
+    bdev_payload_init init[];
 };
 
-uint32_t payloads_sz = sizeof(payloads) / sizeof(bdev_payload_init);
+static struct bdev_entry *bdev[BDEV_MAX];
+static struct bdev_payloads *payloads = (void *)0;
+static struct spinlock bdev_lock = SPINLOCK_INIT("bdev");
+
+static void bdev_rcu_free(struct rcu_head *head) {
+    free(container_of(head, struct bdev_entry, rcu));
+}
+
+static void bdev_payloads_rcu_free(struct rcu_head *head) {
+    free(container_of(head, struct bdev_payloads, rcu));
+}
 
 void bdev_init() {
     memset(&bdev, 0, sizeof(bdev));
+
+    bdev_register_payload(mbr_init);
+    bdev_register_payload(fat_init);
 }
 
-int bdev_register(struct bdev_operation *ops, void *ext) {
-    for (int i = 0; i < 8; i++) {
-        if (bdev[i].reserved == 0) {
-            bdev[i].reserved = 1;
-            bdev[i].ops = ops;
-            bdev[i].bdev = ext;
-
-            for(uint32_t j = 0; j < payloads_sz; j++) {
-                switch(payloads[j](i)) {
-                    case BDEV_SUCCESS:
-                        kprintf("fsdfs\n");
-                        return i;
-                    case BDEV_ERROR:
-                        kprintf("BDEv_ERROR\n");
-                        return i;
-                    default:
-                        break;
-                }
-            }
+//probed in registration order, the new one comes last
+int bdev_register_payload(bdev_payload_init init) {
+    unsigned int flags = spin_lock_irqsave(&bdev_lock);
+    struct bdev_payloads *old = payloads;
+    uint32_t count = old != (void *)0 ? old->count : 0;
+    struct bdev_payloads *new = malloc(sizeof(struct bdev_payloads) + (count + 1) * sizeof(bdev_payload_init));
+
+    if (new == (void *)0) {
+        spin_unlock_irqrestore(&bdev_lock, flags);
+        return (1);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        new->init[i] = old->init[i];
+    }
+    new->init[count] = init;
+    new->count = count + 1;
 
+    rcu_assign_pointer(payloads, new);
+    if (old != (void *)0) {
+        call_rcu(&old->rcu, bdev_payloads_rcu_free);
+    }
+
+    spin_unlock_irqrestore(&bdev_lock, flags);
+    return (0);
+}
+
+//the payloads register the devices they find (partitions), bdev_lock is not held
+static int bdev_probe(uint8_t device) {
+    for (uint32_t j = 0;; j++) {
+        bdev_payload_init init = (void *)0;
+
+        rcu_read_lock();
+        struct bdev_payloads *table = rcu_dereference(payloads);
+        if (table != (void *)0 && j < table->count) {
+            init = table->init[j];
+        }
+        rcu_read_unlock();
+
+        if (init == (void *)0) {
             return -2;
         }
+
+        switch(init(device)) {
+            case BDEV_SUCCESS:
+                kprintf("fsdfs\n");
+                return device;
+            case BDEV_ERROR:
+                kprintf("BDEv_ERROR\n");
+                return device;
+            default:
+                break;
+        }
+    }
+}
+
+int bdev_register(struct bdev_operation *ops, void *ext) {
+    struct bdev_entry *entry = malloc(sizeof(struct bdev_entry));
+
+    if (entry == (void *)0) {
+        return -1;
+    }
+
+    entry->ops = ops;
+    entry->bdev = ext;
+
+    unsigned int flags = spin_lock_irqsave(&bdev_lock);
+    for (int i = 0; i < BDEV_MAX; i++) {
+        if (bdev[i] == (void *)0) {
+            rcu_assign_pointer(bdev[i], entry);
+            spin_unlock_irqrestore(&bdev_lock, flags);
+
+            return bdev_probe(i);
+        }
     }
+    spin_unlock_irqrestore(&bdev_lock, flags);
 
+    free(entry);
     return -1;
 }
 
+//the caller makes sure no new i/o gets started, the ones already past the
+//lookup may still run until the grace period ends
+int bdev_unregister(uint8_t device) {
+    if (device >= BDEV_MAX) {
+        return -1;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&bdev_lock);
+    struct bdev_entry *entry = bdev[device];
+
+    if (entry != (void *)0) {
+        rcu_assign_pointer(bdev[device], (void *)0);
+        call_rcu(&entry->rcu, bdev_rcu_free);
+    }
+
+    spin_unlock_irqrestore(&bdev_lock, flags);
+    return entry != (void *)0 ? 0 : -1;
+}
+
 int bdev_read(uint8_t device, uint32_t numsect, uint32_t lba, void *edi) {
-    if (bdev[device].reserved == 0) {
+    int (*read)(void *bdev, uint32_t numsect, uint32_t lba, void *edi);
+    void *ext;
+
+    if (device >= BDEV_MAX) {
+        return -1;
+    }
+
+    rcu_read_lock();
+    struct bdev_entry *entry = rcu_dereference(bdev[device]);
+    if (entry == (void *)0) {
+        rcu_read_unlock();
         return -1;
     }
+    read = entry->ops->read;
+    ext = entry->bdev;
+    rcu_read_unlock();
 
-    if (bdev[device].ops->read == (void *)0) {
+    if (read == (void *)0) {
         return -2;
     }
 
-    return bdev[device].ops->read(bdev[device].bdev, numsect, lba, edi);
+    return read(ext, numsect, lba, edi);
 }
 
 int bdev_write(uint8_t device, uint32_t numsect, uint32_t lba, void *edi) {
-    if (bdev[device].reserved == 0) {
+    int (*write)(void *bdev, uint32_t numsect, uint32_t lba, void *edi);
+    void *ext;
+
+    if (device >= BDEV_MAX) {
+        return -1;
+    }
+
+    rcu_read_lock();
+    struct bdev_entry *entry = rcu_dereference(bdev[device]);
+    if (entry == (void *)0) {
+        rcu_read_unlock();
         return -1;
     }
+    write = entry->ops->write;
+    ext = entry->bdev;
+    rcu_read_unlock();
 
-    if (bdev[device].ops->write == (void *)0) {
+    if (write == (void *)0) {
         return -2;
     }
 
-    return bdev[device].ops->write(bdev[device].bdev, numsect, lba, edi);
-} 
\ No newline at end of file
+    return write(ext, numsect, lba, edi);
+}
@@ -14,8 +14,12 @@ struct bdev_operation{
     int (*write)(void *bdev, uint32_t numsect, uint32_t lba, void *edi);
 };
 
+typedef enum bdev_payload_status (*bdev_payload_init)(uint8_t device);
+
 void bdev_init(void);
+int bdev_register_payload(bdev_payload_init init);
 int bdev_register(struct bdev_operation *ops, void *ext);
+int bdev_unregister(uint8_t device);
 int bdev_read(uint8_t device, uint32_t numsect, uint32_t lba, void *edi);
 int bdev_write(uint8_t device, uint32_t numsect, uint32_t lba, void *edi);
 
@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include "clocksource.h"
+#include "acpi.h"
+#include "io.h"
+#include "klog.h"
+#include "timer.h"
+#include "lock.h"
+#include "stdlib.h"
+
+// ktime is base_ns plus the current source's cycles since base_cycles. A
+// timer folds the elapsed cycles into the base twice a second, before the
+// slow counters wrap (the 24 bit pm timer does every 4.6 s). The same
+// timer runs the watchdog: a source flagged for verification is compared
+// with the acpi pm timer and dropped when they drift apart. Readers don't
+// lock: they take a consistent copy of the base under ktime_lock's
+// sequence and retry when a fold or a source change went through.
+
+#define CLOCKSOURCE_WATCHDOG_MS 500
+#define CLOCKSOURCE_MAX_DRIFT_SHIFT 6 //more than 1/64 off the watchdog
+
+#define ACPI_PM_FREQUENCY 3579545
+
+struct clocksource *clocksource_current = (void *)0;
+static struct clocksource *clocksources = (void *)0;
+
+static struct seqlock ktime_lock = SEQLOCK_INIT("ktime");
+static uint64_t base_cycles;
+static uint64_t base_ns;
+static uint64_t last_ns; //what was returned last, ktime doesn't go back
+
+static struct clocksource *watchdog = (void *)0;
+static uint64_t watchdog_last;
+static uint64_t watchdog_cs_last;
+
+static uint64_t acpi_pm_read(void) {
+    return inl(acpi_fadt.pm_timer_port);
+}
+
+static struct clocksource acpi_pm_clocksource = {
+    .name = "acpi_pm",
+    .read = acpi_pm_read,
+    .rating = 100,
+    .flags = CLOCKSOURCE_CONTINUOUS,
+};
+
+//largest shift for which mult still fits 32 bits, for precision
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t freq, uint32_t ns_per_unit) {
+    *shift = 32;
+
+    while (*shift > 0 && div_u64((uint64_t)ns_per_unit << *shift, freq) > 0xFFFFFFFF) {
+        (*shift)--;
+    }
+
+    *mult = div_u64((uint64_t)ns_per_unit << *shift, freq);
+}
+
+uint64_t clocksource_cycles_to_ns(const struct clocksource *cs, uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, cs->mult, cs->shift);
+}
+
+//atomic 64 bit read. Not __atomic_load_n: on i686 it goes through the
+//x87 (fild/fistp), which traps with the fpu state switched out. A
+//cmpxchg8b that only writes back what it found does it
+static inline uint64_t ktime_last_ns(void) {
+    uint64_t last = 0;
+
+    __atomic_compare_exchange_n(&last_ns, &last, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return last;
+}
+
+//ns unless some cpu already returned later, atomic max on last_ns
+static uint64_t ktime_clamp(uint64_t ns) {
+    uint64_t last = ktime_last_ns(); //not a plain read: a torn one past ns would be returned as is
+
+    while (ns > last) {
+        if (__atomic_compare_exchange_n(&last_ns, &last, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return ns;
+        }
+    }
+
+    return last;
+}
+
+uint64_t ktime_get_ns() {
+    struct clocksource *cs;
+    uint64_t cycles, cycles_base, ns_base;
+    uint32_t sequence;
+
+    do {
+        sequence = read_seqbegin(&ktime_lock);
+        cs = clocksource_current;
+        if (cs == (void *)0) {
+            return (0);
+        }
+        cycles = cs->read();
+        cycles_base = base_cycles;
+        ns_base = base_ns;
+    } while (read_seqretry(&ktime_lock, sequence));
+
+    return ktime_clamp(ns_base + clocksource_cycles_to_ns(cs, (cycles - cycles_base) & cs->mask));
+}
+
+//under ktime_lock
+static void clocksource_fold(void) {
+    uint64_t cycles = clocksource_current->read();
+
+    base_ns = ktime_clamp(base_ns + clocksource_cycles_to_ns(clocksource_current, (cycles - base_cycles) & clocksource_current->mask));
+    base_cycles = cycles;
+}
+
+//under ktime_lock
+static void clocksource_select(void) {
+    struct clocksource *best = (void *)0;
+
+    for (struct clocksource *cs = clocksources; cs != (void *)0; cs = cs->next) {
+        if ((cs->flags & CLOCKSOURCE_UNSTABLE) == 0 && (best == (void *)0 || cs->rating > best->rating)) {
+            best = cs;
+        }
+    }
+
+    if (best == clocksource_current) {
+        return;
+    }
+
+    if (clocksource_current != (void *)0) {
+        clocksource_fold();
+    }
+
+    clocksource_current = best;
+    base_cycles = best->read();
+    watchdog_last = 0;
+
+    klog_info("clocksource: %s\n", best->name);
+}
+
+void clocksource_register(struct clocksource *cs) {
+    unsigned int flags = write_seqlock_irqsave(&ktime_lock);
+
+    cs->next = clocksources;
+    clocksources = cs;
+    clocksource_select();
+
+    write_sequnlock_irqrestore(&ktime_lock, flags);
+}
+
+static void clocksource_watchdog(void) {
+    struct clocksource *cs = clocksource_current;
+
+    if (watchdog == (void *)0 || cs == watchdog || (cs->flags & CLOCKSOURCE_VERIFY) == 0) {
+        return;
+    }
+
+    uint64_t watchdog_now = watchdog->read();
+    uint64_t cs_now = cs->read();
+
+    if (watchdog_last != 0) {
+        uint64_t watchdog_ns = clocksource_cycles_to_ns(watchdog, (watchdog_now - watchdog_last) & watchdog->mask);
+        uint64_t cs_ns = clocksource_cycles_to_ns(cs, (cs_now - watchdog_cs_last) & cs->mask);
+        uint64_t drift = cs_ns > watchdog_ns ? cs_ns - watchdog_ns : watchdog_ns - cs_ns;
+        uint64_t wrap_ns = clocksource_cycles_to_ns(watchdog, watchdog->mask);
+
+        //only trust the watchdog when it can't have wrapped in between
+        if ((cs->mask == ~(uint64_t)0 && cs_now < watchdog_cs_last) ||
+            (cs_ns < wrap_ns / 2 && drift > watchdog_ns >> CLOCKSOURCE_MAX_DRIFT_SHIFT)) {
+            klog_warn("clocksource: %s unstable (%d ns vs %d ns on %s)\n", cs->name, (uint32_t)cs_ns, (uint32_t)watchdog_ns, watchdog->name);
+            cs->flags |= CLOCKSOURCE_UNSTABLE;
+            clocksource_select();
+            return;
+        }
+    }
+
+    watchdog_last = watchdog_now;
+    watchdog_cs_last = cs_now;
+}
+
+static void clocksource_timer_fnc(void *ext);
+static struct timer clocksource_timer = TIMER_INIT(clocksource_timer_fnc, (void *)0);
+
+static void clocksource_timer_fnc(void *ext __attribute__((unused))) {
+    unsigned int flags = write_seqlock_irqsave(&ktime_lock);
+
+    clocksource_fold();
+    clocksource_watchdog();
+
+    write_sequnlock_irqrestore(&ktime_lock, flags);
+    timer_add(&clocksource_timer, CLOCKSOURCE_WATCHDOG_MS);
+}
+
+void clocksource_watchdog_start() {
+    if (clocksource_current != (void *)0) {
+        timer_add(&clocksource_timer, CLOCKSOURCE_WATCHDOG_MS);
+    }
+}
+
+//after tsc_init and acpi_init
+void clocksource_init() {
+    if (acpi_fadt.pm_timer_port == 0) {
+        return;
+    }
+
+    acpi_pm_clocksource.mask = acpi_fadt.pm_timer_32bit ? 0xFFFFFFFF : 0xFFFFFF;
+    clocks_calc_mult_shift(&acpi_pm_clocksource.mult, &acpi_pm_clocksource.shift, ACPI_PM_FREQUENCY, NSEC_PER_SEC);
+
+    watchdog = &acpi_pm_clocksource;
+    clocksource_register(&acpi_pm_clocksource);
+}
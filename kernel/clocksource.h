@@ -0,0 +1,36 @@
+#ifndef __CLOCKSOURCE__
+#define __CLOCKSOURCE__
+
+#include <stdint.h>
+
+// Free running counters the kernel reads the time from. The best rated one
+// is used; ktime_get_ns() never goes backwards, even across a switch.
+
+#define CLOCKSOURCE_CONTINUOUS 0x1 //counts on its own, not with timer ticks
+#define CLOCKSOURCE_VERIFY 0x2 //checked against the watchdog source
+#define CLOCKSOURCE_UNSTABLE 0x4
+
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+
+struct clocksource {
+    const char *name;
+    uint64_t (*read)(void);
+    uint64_t mask; //the counter wraps at mask + 1
+    uint32_t mult; //ns = (cycles * mult) >> shift
+    uint32_t shift;
+    uint32_t rating;
+    uint32_t flags;
+    struct clocksource *next;
+};
+
+extern struct clocksource *clocksource_current;
+
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t freq, uint32_t ns_per_unit);
+void clocksource_register(struct clocksource *cs);
+void clocksource_init(void);
+void clocksource_watchdog_start(void);
+uint64_t clocksource_cycles_to_ns(const struct clocksource *cs, uint64_t cycles);
+uint64_t ktime_get_ns(void);
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include "console.h"
+#include "serial.h"
+#include "vga.h"
+#include "stdlib.h"
+
+// Where kernel log and syscall_write output goes. Chosen on the multiboot
+// command line like linux does: console=tty0 for vga, console=ttyS0[,baud]
+// for COM1, the option can be repeated. Without it both are used.
+
+uint32_t console_sinks = CONSOLE_VGA;
+
+static int console_match(const char *s, const char *prefix) {
+    while (*prefix != '\0') {
+        if (*s++ != *prefix++) {
+            return (0);
+        }
+    }
+    return (1);
+}
+
+static uint32_t console_parse_baud(const char *s) {
+    uint32_t baud = 0;
+
+    while (*s >= '0' && *s <= '9') {
+        baud = baud * 10 + (*s++ - '0');
+    }
+
+    return baud ? baud : SERIAL_BAUD;
+}
+
+void console_init(const char *cmdline) {
+    uint32_t sinks = 0;
+    uint32_t baud = SERIAL_BAUD;
+
+    for (const char *p = cmdline; p != (void *)0 && *p != '\0'; p++) {
+        if ((p != cmdline && p[-1] != ' ') || !console_match(p, "console=")) {
+            continue;
+        }
+
+        p += sizeof("console=") - 1;
+        if (console_match(p, "ttyS0")) {
+            sinks |= CONSOLE_SERIAL;
+            if (p[5] == ',') {
+                baud = console_parse_baud(p + 6);
+            }
+        } else if (console_match(p, "tty0")) {
+            sinks |= CONSOLE_VGA;
+        }
+    }
+
+    if (sinks == 0) {
+        sinks = CONSOLE_VGA | CONSOLE_SERIAL;
+    }
+
+    if ((sinks & CONSOLE_SERIAL) && serial_init(baud) != 0) {
+        sinks = (sinks & ~CONSOLE_SERIAL) | CONSOLE_VGA;
+    }
+
+    console_sinks = sinks;
+}
+
+void console_write(const char *buffer, uint32_t size) {
+    if (console_sinks & CONSOLE_SERIAL) {
+        serial_write(buffer, size);
+    }
+
+    if (console_sinks & CONSOLE_VGA) {
+        vga_write(buffer, size);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef __CONSOLE__
+#define __CONSOLE__
+
+#include <stdint.h>
+
+#define CONSOLE_VGA 0x1
+#define CONSOLE_SERIAL 0x2
+
+extern uint32_t console_sinks;
+
+void console_init(const char *cmdline);
+void console_write(const char *buffer, uint32_t size);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include "cpu.h"
+#include "stdlib.h"
+#include "fpu.h"
+
+#define CPUID_LEAF1_EDX_PSE (1 << 3)
+#define CPUID_LEAF1_EDX_TSC (1 << 4)
+#define CPUID_LEAF1_EDX_APIC (1 << 9)
+#define CPUID_LEAF1_EDX_SEP (1 << 11)
+#define CPUID_LEAF1_EDX_PGE (1 << 13)
+#define CPUID_LEAF1_EDX_FXSR (1 << 24)
+#define CPUID_LEAF1_EDX_SSE (1 << 25)
+#define CPUID_LEAF1_EDX_SSE2 (1 << 26)
+#define CPUID_LEAF1_ECX_SSSE3 (1 << 9)
+#define CPUID_LEAF7_EBX_ERMS (1 << 9)
+
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define EFLAGS_ID (1 << 21)
+
+struct cpu_info cpu_info;
+
+static const char *cpu_feature_names[] = {
+    "pse", "tsc", "apic", "sep", "pge", "fxsr", "sse", "sse2", "ssse3", "erms",
+};
+
+//cpuid exists when the id flag of eflags can be toggled
+static int cpu_has_cpuid(void) {
+    uint32_t before, after;
+
+    asm volatile(
+        "pushf\n"
+        "pop %0\n"
+        "mov %0, %1\n"
+        "xor %2, %1\n"
+        "push %1\n"
+        "popf\n"
+        "pushf\n"
+        "pop %1\n"
+        "push %0\n"
+        "popf"
+        : "=&r"(before), "=&r"(after) : "i"(EFLAGS_ID)
+    );
+
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
+
+static void cpu_detect(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    memset(&cpu_info, 0, sizeof(cpu_info));
+    if (!cpu_has_cpuid()) {
+        return;
+    }
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    cpu_info.max_leaf = eax;
+    memcpy(&cpu_info.vendor[0], &ebx, 4);
+    memcpy(&cpu_info.vendor[4], &edx, 4);
+    memcpy(&cpu_info.vendor[8], &ecx, 4);
+
+    if (cpu_info.max_leaf >= 1) {
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        cpu_info.stepping = eax & 0xf;
+        cpu_info.model = (eax >> 4) & 0xf;
+        cpu_info.family = (eax >> 8) & 0xf;
+        if (cpu_info.family == 0xf) {
+            cpu_info.family += (eax >> 20) & 0xff;
+        }
+        if (cpu_info.family == 0x6 || cpu_info.family >= 0xf) {
+            cpu_info.model += ((eax >> 16) & 0xf) << 4;
+        }
+
+        if (edx & CPUID_LEAF1_EDX_PSE) cpu_info.features |= 1 << CPU_FEATURE_PSE;
+        if (edx & CPUID_LEAF1_EDX_TSC) cpu_info.features |= 1 << CPU_FEATURE_TSC;
+        if (edx & CPUID_LEAF1_EDX_APIC) cpu_info.features |= 1 << CPU_FEATURE_APIC;
+        if (edx & CPUID_LEAF1_EDX_PGE) cpu_info.features |= 1 << CPU_FEATURE_PGE;
+        if (edx & CPUID_LEAF1_EDX_FXSR) cpu_info.features |= 1 << CPU_FEATURE_FXSR;
+        if (edx & CPUID_LEAF1_EDX_SSE) cpu_info.features |= 1 << CPU_FEATURE_SSE;
+        if (edx & CPUID_LEAF1_EDX_SSE2) cpu_info.features |= 1 << CPU_FEATURE_SSE2;
+        if (ecx & CPUID_LEAF1_ECX_SSSE3) cpu_info.features |= 1 << CPU_FEATURE_SSSE3;
+
+        //the sep bit is bogus on the early pentium pro (family 6, model < 3, stepping < 3)
+        if ((edx & CPUID_LEAF1_EDX_SEP) && !(cpu_info.family == 6 && cpu_info.model < 3 && cpu_info.stepping < 3)) {
+            cpu_info.features |= 1 << CPU_FEATURE_SEP;
+        }
+    }
+
+    if (cpu_info.max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_LEAF7_EBX_ERMS) cpu_info.features |= 1 << CPU_FEATURE_ERMS;
+    }
+}
+
+//pick the best implementation of the hot primitives for this cpu. memcpy
+//and memset never use sse: they may fault on a lazy user or file page and
+//sleep in the disk path with the xmm registers live. zero_page only ever
+//gets a frame that is already mapped
+static void cpu_select_alternatives(void) {
+    if (cpu_has(CPU_FEATURE_ERMS)) {
+        memcpy_large = memcpy_erms;
+        memset_large = memset_erms;
+    }
+
+    if (cpu_has(CPU_FEATURE_SSE2)) {
+        zero_page = zero_page_sse2_kernel;
+    }
+}
+
+void cpu_init() {
+    cpu_detect();
+
+    kprintf("cpu: %s family 0x%h model 0x%h stepping 0x%h\n", cpu_info.vendor, cpu_info.family, cpu_info.model, cpu_info.stepping);
+    kprintf("cpu features:");
+    for (uint32_t i = 0; i < sizeof(cpu_feature_names) / sizeof(cpu_feature_names[0]); i++) {
+        if (cpu_has(i)) {
+            kprintf(" %s", cpu_feature_names[i]);
+        }
+    }
+    kprintf("\n");
+
+    if (cpu_has(CPU_FEATURE_FXSR) && cpu_has(CPU_FEATURE_SSE2)) {
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    } else {
+        cpu_info.features &= ~((1 << CPU_FEATURE_SSE) | (1 << CPU_FEATURE_SSE2) | (1 << CPU_FEATURE_SSSE3));
+    }
+
+    cpu_select_alternatives();
+}
+
+//same control register setup on the other processors, the features are the boot processor's
+void cpu_init_ap() {
+    if (cpu_has(CPU_FEATURE_SSE2)) {
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef __CPU__
+#define __CPU__
+
+#include <stdint.h>
+
+enum cpu_feature {
+    CPU_FEATURE_PSE,
+    CPU_FEATURE_TSC,
+    CPU_FEATURE_APIC,
+    CPU_FEATURE_SEP, //sysenter/sysexit
+    CPU_FEATURE_PGE,
+    CPU_FEATURE_FXSR,
+    CPU_FEATURE_SSE,
+    CPU_FEATURE_SSE2,
+    CPU_FEATURE_SSSE3,
+    CPU_FEATURE_ERMS, //enhanced rep movsb/stosb
+};
+
+struct cpu_info {
+    char vendor[13];
+    uint32_t max_leaf;
+    uint32_t family;
+    uint32_t model;
+    uint32_t stepping;
+    uint32_t features; //bit n set when enum cpu_feature n is supported
+};
+
+extern struct cpu_info cpu_info;
+
+void cpu_init(void);
+void cpu_init_ap(void);
+
+static inline int cpu_has(enum cpu_feature feature) {
+    return (cpu_info.features >> feature) & 1;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    asm volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    asm volatile("mov %0, %%cr0" :: "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    asm volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    asm volatile("mov %0, %%cr4" :: "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t value;
+    asm volatile("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    asm volatile("mov %0, %%cr3" :: "r"(value) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#endif
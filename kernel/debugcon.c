@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include "debugcon.h"
+#include "serial.h"
+#include "softirq.h"
+#include "interrupt.h"
+#include "heap_profile.h"
+#include "syscall.h"
+#include "task.h"
+#include "lock.h"
+#include "rcu.h"
+#include "stdlib.h"
+
+// Debug console: one letter commands typed on COM1 dump kernel statistics.
+// Only with "debugcon" on the command line, it then owns the serial input
+// (nothing is left for a userspace serial read).
+
+static void debugcon_work(void *ext __attribute__((unused))) {
+    char c;
+
+    while (serial_read(&c, 1) == 1) {
+        switch (c) {
+            case 'i':
+                interrupt_stats_dump();
+                softirq_dump();
+                break;
+
+            case 'h':
+                heap_profile_dump();
+                break;
+
+            case 's':
+                syscall_stats_dump();
+                break;
+
+            case 't':
+                task_dump();
+                break;
+
+            case 'c':
+                sched_dump();
+                rcu_dump();
+                break;
+
+            case 'l':
+                lock_stat_dump();
+                break;
+
+            case '\r':
+            case '\n':
+                break;
+
+            default:
+                kprintf("debugcon: i interrupts, h heap, s syscalls, t tasks, c cpus, l locks\n");
+                break;
+        }
+    }
+}
+
+static struct work_item debugcon_work_item = WORK_ITEM_INIT(debugcon_work, (void *)0);
+
+static int debugcon_enabled(const char *cmdline) {
+    const char *option = "debugcon";
+
+    for (const char *p = cmdline; p != (void *)0 && *p != '\0'; p++) {
+        uint32_t i = 0;
+
+        if (p != cmdline && p[-1] != ' ') {
+            continue;
+        }
+
+        while (option[i] != '\0' && p[i] == option[i]) {
+            i++;
+        }
+        if (option[i] == '\0' && (p[i] == ' ' || p[i] == '\0')) {
+            return (1);
+        }
+    }
+
+    return (0);
+}
+
+void debugcon_init(const char *cmdline) {
+    if (!debugcon_enabled(cmdline) || !serial_present()) {
+        return;
+    }
+
+    serial_rx_notify(&debugcon_work_item);
+    kprintf("debugcon: on COM1\n");
+}
@@ -0,0 +1,6 @@
+#ifndef __DEBUGCON__
+#define __DEBUGCON__
+
+void debugcon_init(const char *cmdline);
+
+#endif
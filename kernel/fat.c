@@ -2,6 +2,7 @@
 #include "bdev.h"
 #include "fat.h"
 #include "stdlib.h"
+#include "arena.h"
 
 struct fat_bpb_common {
 	uint8_t BS_jmpBoot[3];
@@ -209,7 +210,7 @@ void fat_sector_itearator(struct fat_sector_itearator *iter, struct fat_director
 }
 
 uint32_t fat_sector_iterator_next(struct fat_sector_itearator *iter) {
-	uint8_t buffer[512];
+	uint8_t *buffer;
 	uint32_t err;
 
 	uint32_t sector = iter->current_sector;
@@ -246,6 +247,15 @@ uint32_t fat_sector_iterator_next(struct fat_sector_itearator *iter) {
 				break;
 		}
 
+		struct arena *scratch = arena_scratch();
+		arena_mark_t mark = arena_mark(scratch);
+		buffer = arena_alloc_aligned(scratch, 512, ARENA_SECTOR_ALIGN);
+		if (buffer == (void *)0) {
+			kprintf("fat_sector_iterator_next: out of scratch memory\n");
+			iter->eoi = 1;
+			return (0);
+		}
+
 		if ((err = bdev_read(iter->fat->device, 1, ThisFATSecNum, buffer)) != 0) {
 			kprintf("ide_read_sectore error (%d)\n", err);
 			iter->eoi = 1;
@@ -288,6 +298,8 @@ uint32_t fat_sector_iterator_next(struct fat_sector_itearator *iter) {
 		if (iter->current_cluster != 0) {
 			iter->current_sector = iter->fat->fat_first_sector_data + (iter->current_cluster - 2) * iter->fat->fat_cluster_size;
 		}
+
+		arena_reset(scratch, mark);
 	}
 
 	return sector;
@@ -451,51 +463,64 @@ int fat_seek(struct file *file, uint32_t offset, uint8_t whence) {
 }
 
 int fat_read(struct file *file, void *buffer, uint32_t size) {
-	uint8_t tmp_buffer[512];
+	struct arena *scratch = arena_scratch();
+	arena_mark_t mark = arena_mark(scratch);
+	uint8_t *tmp_buffer;
 	int e, i;
 	uint32_t sec;
 
+	tmp_buffer = arena_alloc_aligned(scratch, 512, ARENA_SECTOR_ALIGN);
+	if (tmp_buffer == (void *)0) {
+		return -1;
+	}
+
 	//kprintf("read last sec\noffset: %1d: size: %1d; buffer: 0x%8h\n", file->offset, size, buffer);
 	i = 0;
 	if ((e = bdev_read(file->iter.fat->device, 1, file->iter.current_sector, tmp_buffer)) != 0) {
-		return e;
+		goto out;
 	}
 
 	e = min(size, 512 - (file->offset % 512));
 	memcpy(buffer, &tmp_buffer[file->offset % 512], e);
 	if (size <= e) {
 		file->offset += e;
-		return e;
+		goto out;
 	}
 	i = e;
 
 	for (; (i / 512) < (size / 512); i += 512) {
 		sec = fat_sector_iterator_next(&file->iter);
 		if (sec == 0) {
-			return (i);
+			e = i;
+			goto out;
 		}
 
 		if ((e = bdev_read(file->iter.fat->device, 1, sec, &buffer[i])) != 0) {
-			return e;
+			goto out;
 		}
 	}
 
 	if (i == size) {
 		file->offset += i;
-		return i;
+		e = i;
+		goto out;
 	}
 	
 	sec = fat_sector_iterator_next(&file->iter);
 	if (sec == 0) {
-		return (i);
+		e = i;
+		goto out;
 	}
 	
 	if ((e = bdev_read(file->iter.fat->device, 1, sec, tmp_buffer)) != 0) {
-		return e;
+		goto out;
 	}
 
 	memcpy(&buffer[i], tmp_buffer, size - i);
 	file->offset += size;
+	e = size;
 
-	return size;
-}
\ No newline at end of file
+out:
+	arena_reset(scratch, mark);
+	return e;
+}
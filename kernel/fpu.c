@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include "fpu.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "stdlib.h"
+
+// Lazy fpu switching: the registers are only saved/restored when a context
+// actually uses the fpu. Switching sets cr0.ts, and the first fpu/sse
+// instruction afterwards raises #NM (interrupt 7), which swaps the state in.
+// The bookkeeping is per cpu (struct cpu), each has its own registers.
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+
+#define FPU_NM_INTERRUPT 7
+
+static inline void clts(void) {
+    asm volatile("clts");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(struct fpu_state *state) {
+    asm volatile("fxsave %0" : "=m"(state->fxsave));
+}
+
+static inline void fxrstor(struct fpu_state *state) {
+    asm volatile("fxrstor %0" :: "m"(state->fxsave));
+}
+
+static int fpu_nm_interrupt_handler(unsigned int interrupt __attribute__((unused)), void *ext __attribute__((unused))) {
+    struct cpu *cpu = this_cpu();
+
+    clts();
+
+    if (cpu->fpu_owner == cpu->fpu_current) {
+        return (IRQ_HANDLED);
+    }
+
+    if (cpu->fpu_owner != (void *)0) {
+        fxsave(cpu->fpu_owner);
+    }
+
+    if (cpu->fpu_current == (void *)0) {
+        //nobody to give the fpu to, keep it clean
+        asm volatile("fninit");
+    } else if (cpu->fpu_current->used) {
+        fxrstor(cpu->fpu_current);
+    } else {
+        asm volatile("fninit");
+        cpu->fpu_current->used = 1;
+    }
+
+    cpu->fpu_owner = cpu->fpu_current;
+    return (IRQ_HANDLED);
+}
+
+//each cpu, its cr0 is its own
+void fpu_init_cpu() {
+    uint32_t cr0 = read_cr0();
+
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE | CR0_TS;
+    write_cr0(cr0);
+}
+
+void fpu_init() {
+    fpu_init_cpu();
+    register_interrupt(FPU_NM_INTERRUPT, fpu_nm_interrupt_handler, 0);
+}
+
+//called when switching context: the registers stay where they are until needed
+void fpu_switch(struct fpu_state *next) {
+    struct cpu *cpu = this_cpu();
+
+    cpu->fpu_current = next;
+
+    if (next != cpu->fpu_owner) {
+        stts();
+    } else {
+        clts();
+    }
+}
+
+//the state is about to be freed, forget it without saving the registers
+//(on every cpu, the task may have run anywhere)
+void fpu_release(struct fpu_state *state) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].fpu_owner == state) {
+            cpus[i].fpu_owner = (void *)0;
+        }
+        if (cpus[i].fpu_current == state) {
+            cpus[i].fpu_current = (void *)0;
+        }
+    }
+}
+
+//let kernel code use sse: push the owner's registers to memory first.
+//returns non zero when the fpu can't be used right now (no fxsr, or an
+//outer kernel_fpu_begin is active, e.g. an interrupt handler zeroing a
+//page), the caller then has to take its integer path.
+int kernel_fpu_begin() {
+    struct cpu *cpu = this_cpu();
+
+    if (!cpu_has(CPU_FEATURE_FXSR) || cpu->fpu_kernel_active) {
+        return 1;
+    }
+
+    cpu->fpu_kernel_active = 1;
+    clts();
+    if (cpu->fpu_owner != (void *)0) {
+        fxsave(cpu->fpu_owner);
+        cpu->fpu_owner = (void *)0;
+    }
+
+    return 0;
+}
+
+void kernel_fpu_end() {
+    struct cpu *cpu = this_cpu();
+
+    //the registers now hold garbage, the next user of the fpu reloads its state
+    stts();
+    cpu->fpu_kernel_active = 0;
+}
+
+//on a mapped frame only: nothing may fault, let alone sleep, inside a
+//kernel_fpu_begin/end section, the state is per cpu
+void zero_page_sse2_kernel(void *page) {
+    if (kernel_fpu_begin() != 0) {
+        zero_page_stosd(page);
+        return;
+    }
+
+    zero_page_sse2(page);
+    kernel_fpu_end();
+}
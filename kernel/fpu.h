@@ -0,0 +1,23 @@
+#ifndef __FPU__
+#define __FPU__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//fxsave area, has to be 16 bytes aligned
+struct fpu_state {
+    uint8_t fxsave[512];
+    uint8_t used; //the context touched the fpu at least once
+} __attribute__((aligned(16)));
+
+void fpu_init(void);
+void fpu_init_cpu(void);
+void fpu_switch(struct fpu_state *next);
+void fpu_release(struct fpu_state *state);
+int kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+//sse2 zero_page wrapped in kernel_fpu_begin/end, for the alternatives
+void zero_page_sse2_kernel(void *page);
+
+#endif
@@ -1,7 +1,11 @@
 
-extern void load_gdt(void);
-extern void tss_flush(void);
-extern void write_tss(unsigned short ss0, unsigned int esp0);
+#include <stdint.h>
+#include "smp.h"
+
+struct gdt_ptr;
+
+extern void load_gdt(struct gdt_ptr *gdt);
+extern void tss_setup_cpu(uint32_t cpu, uint32_t esp0);
 extern void stack_space(void);
 
 struct gdt_entry {
@@ -18,37 +22,48 @@ struct gdt_ptr {
     unsigned int base;                // The address of the first gdt_entry_t struct.
 } __attribute__((packed));
 
-#define GDT_ENTRIES_SZ 6
 #define GDT_CS_KERN 1
 #define GDT_DS_KERN 2
 #define GDT_CS_USER 3
 #define GDT_DS_USER 4
 #define GDT_TSS 5
+#define GDT_PERCPU 6 //based on the cpu's struct cpu, SMP_PERCPU_SEL
+#define GDT_ENTRIES_SZ 7
+
+//one gdt per cpu: the same selectors lead to each cpu's own tss and per cpu area
+struct gdt_entry gdt_entries[SMP_MAX_CPUS][GDT_ENTRIES_SZ];
+struct gdt_ptr gdt_base[SMP_MAX_CPUS];
+
+void gdt_set_gate(uint32_t cpu, int num, unsigned int base, unsigned int limit, unsigned char access, unsigned char gran) {
+    struct gdt_entry *entry = &gdt_entries[cpu][num];
+
+    entry->base_low    = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high   = (base >> 24) & 0xFF;
+    entry->limit_low   = (limit & 0xFFFF);
+    entry->granularity = (limit >> 16) & 0x0F;
+    entry->granularity |= gran & 0xF0;
+    entry->access      = access;
+}
+
+//on the cpu itself, before anything uses this_cpu()
+void gdt_setup_cpu(uint32_t cpu) {
+    gdt_set_gate(cpu, 0, 0, 0, 0, 0);                // Null segment 0x00
+    gdt_set_gate(cpu, GDT_CS_KERN, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment 0x08
+    gdt_set_gate(cpu, GDT_DS_KERN, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment 0x10
+    gdt_set_gate(cpu, GDT_CS_USER, 0, 0xFFFFFFFF, 0xFA, 0xCF); // Code segment 0x18
+    gdt_set_gate(cpu, GDT_DS_USER, 0, 0xFFFFFFFF, 0xF2, 0xCF); // Data segment 0x20
+    gdt_set_gate(cpu, GDT_PERCPU, (unsigned int)&cpus[cpu], sizeof(struct cpu) - 1, 0x92, 0x40); // Per cpu 0x30
+    gdt_base[cpu].base = (unsigned int)&gdt_entries[cpu];
+    gdt_base[cpu].limit = sizeof(struct gdt_entry) * GDT_ENTRIES_SZ - 1;
 
-struct gdt_entry gdt_entries[GDT_ENTRIES_SZ];
-struct gdt_ptr gdt_base;
-
-void gdt_set_gate(int num, unsigned int base, unsigned int limit, unsigned char access, unsigned char gran) {
-    gdt_entries[num].base_low    = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high   = (base >> 24) & 0xFF;
-    gdt_entries[num].limit_low   = (limit & 0xFFFF);
-    gdt_entries[num].granularity = (limit >> 16) & 0x0F;
-    gdt_entries[num].granularity |= gran & 0xF0;
-    gdt_entries[num].access      = access;
+    cpus[cpu].self = &cpus[cpu];
+    load_gdt(&gdt_base[cpu]);
+    asm volatile("mov %0, %%gs" :: "r"((uint16_t)SMP_PERCPU_SEL) : "memory");
 }
 
 void setup_gdt() {
-    gdt_set_gate(0, 0, 0, 0, 0);                // Null segment 0x00
-    gdt_set_gate(GDT_CS_KERN, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment 0x08
-    gdt_set_gate(GDT_DS_KERN, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment 0x10
-    gdt_set_gate(GDT_CS_USER, 0, 0xFFFFFFFF, 0xFA, 0xCF); // Code segment 0x18
-    gdt_set_gate(GDT_DS_USER, 0, 0xFFFFFFFF, 0xF2, 0xCF); // Data segment 0x20
-    write_tss(0x10, (unsigned int)&stack_space);
-
-    gdt_base.base = (unsigned int)&gdt_entries;
-    gdt_base.limit = sizeof(struct gdt_entry) * GDT_ENTRIES_SZ - 1;
-
-    load_gdt();
-    tss_flush(); 
+    //the tss gate is filled before the ltr
+    gdt_setup_cpu(0);
+    tss_setup_cpu(0, (unsigned int)&stack_space);
 }
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include "stdlib.h"
+#include "heap_profile.h"
+
+#ifdef HEAP_PROFILE
+
+struct heap_site {
+    void *caller;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+    uint32_t histogram[HEAP_PROFILE_CLASSES];
+};
+
+//slot 0 collects everything once the table is full
+static struct heap_site sites[HEAP_PROFILE_SITES];
+static uint32_t heap_live_bytes;
+static uint32_t heap_peak_bytes;
+
+static uint16_t heap_site_lookup(void *caller) {
+    uint32_t hash = ((uint32_t)caller >> 2) % (HEAP_PROFILE_SITES - 1);
+
+    for (uint32_t probe = 0; probe < HEAP_PROFILE_SITES - 1; probe++) {
+        uint16_t index = 1 + (hash + probe) % (HEAP_PROFILE_SITES - 1);
+
+        if (sites[index].caller == caller) {
+            return index;
+        }
+
+        if (sites[index].caller == (void *)0) {
+            sites[index].caller = caller;
+            return index;
+        }
+    }
+
+    return 0;
+}
+
+uint16_t heap_profile_alloc(void *caller, uint32_t size) {
+    uint16_t index = heap_site_lookup(caller);
+    struct heap_site *site = &sites[index];
+
+    site->allocs++;
+    site->live_bytes += size;
+    if (site->live_bytes > site->peak_bytes) {
+        site->peak_bytes = site->live_bytes;
+    }
+    site->histogram[min(heap_size_class(size), HEAP_PROFILE_CLASSES - 1)]++;
+
+    heap_live_bytes += size;
+    if (heap_live_bytes > heap_peak_bytes) {
+        heap_peak_bytes = heap_live_bytes;
+    }
+
+    return index;
+}
+
+void heap_profile_free(uint16_t index, uint32_t size) {
+    if (index >= HEAP_PROFILE_SITES) {
+        return;
+    }
+
+    sites[index].frees++;
+    sites[index].live_bytes -= size;
+    heap_live_bytes -= size;
+}
+
+//used by calloc/realloc so the block is charged to their caller, not to them
+uint16_t heap_profile_reattribute(uint16_t index, void *caller, uint32_t size) {
+    if (index < HEAP_PROFILE_SITES) {
+        sites[index].allocs--;
+        sites[index].live_bytes -= size;
+        sites[index].histogram[min(heap_size_class(size), HEAP_PROFILE_CLASSES - 1)]--;
+        heap_live_bytes -= size;
+    }
+
+    return heap_profile_alloc(caller, size);
+}
+
+static void heap_profile_dump_sites(void) {
+    kprintf("heap: live %d bytes, peak %d bytes\n", heap_live_bytes, heap_peak_bytes);
+    kprintf("caller       allocs   frees    live     peak\n");
+
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        struct heap_site *site = &sites[i];
+        if (site->allocs == 0) {
+            continue;
+        }
+
+        kprintf("0x%8h %8d %8d %8d %8d\n", site->caller, site->allocs, site->frees, site->live_bytes, site->peak_bytes);
+        kprintf("  sizes:");
+        for (uint32_t c = 0; c < HEAP_PROFILE_CLASSES; c++) {
+            if (site->histogram[c] != 0) {
+                kprintf(" 2^%1d:%1d", c, site->histogram[c]);
+            }
+        }
+        kprintf("\n");
+    }
+}
+
+#endif
+
+void heap_profile_dump(void) {
+    struct heap_frag_report report;
+
+    kprintf("\n=== HEAP DUMP ===\n");
+
+#ifdef HEAP_PROFILE
+    heap_profile_dump_sites();
+#else
+    kprintf("per call site statistics not compiled in (HEAP_PROFILE=1)\n");
+#endif
+
+    memset(&report, 0, sizeof(report));
+    heap_fragmentation(&report);
+
+    kprintf("free: %d blocks, %d bytes, largest %d bytes\n", report.free_blocks, report.free_bytes, report.largest_free);
+    kprintf("free lists:");
+    for (uint32_t c = 0; c < HEAP_FRAG_CLASSES; c++) {
+        if (report.free_lists[c] != 0) {
+            kprintf(" 2^%1d:%1d", c, report.free_lists[c]);
+        }
+    }
+    kprintf("\n");
+}
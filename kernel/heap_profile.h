@@ -0,0 +1,31 @@
+#ifndef __HEAP_PROFILE__
+#define __HEAP_PROFILE__
+
+#include <stdint.h>
+
+#define HEAP_PROFILE_SITES 64
+#define HEAP_PROFILE_CLASSES 16 //log2 size classes, the last one takes everything bigger
+#define HEAP_FRAG_CLASSES 32
+
+struct heap_frag_report {
+    uint32_t free_lists[HEAP_FRAG_CLASSES]; //free blocks per log2 size class
+    uint32_t free_blocks;
+    uint32_t free_bytes;
+    uint32_t largest_free;
+};
+
+//filled by the heap backend (liballoc.c or tlsf.c)
+void heap_fragmentation(struct heap_frag_report *report);
+void heap_profile_dump(void);
+
+static inline uint32_t heap_size_class(uint32_t size) {
+    return size ? 31 - __builtin_clz(size) : 0;
+}
+
+#ifdef HEAP_PROFILE
+uint16_t heap_profile_alloc(void *caller, uint32_t size);
+void heap_profile_free(uint16_t site, uint32_t size);
+uint16_t heap_profile_reattribute(uint16_t site, void *caller, uint32_t size);
+#endif
+
+#endif
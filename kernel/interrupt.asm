@@ -15,9 +15,17 @@ interrupt_handler_%1:
 
 extern interrupt_handler
 
+%define PERCPU_SEL 0x30 ; SMP_PERCPU_SEL (smp.h)
+
 common_interrupt_handler:
 	; Save registers
 	pusha ; Pushes edi, esi, ebp, esp, ebx, edx, ecx, eax
+	cld ; stdlib string functions expect a clear direction flag
+
+	; this cpu's per cpu area, the same selector in every cpu's gdt
+	push gs
+	mov ax, PERCPU_SEL
+	mov gs, ax
 
 	; Save CR3
 	mov eax, cr3
@@ -32,6 +40,8 @@ common_interrupt_handler:
 	pop eax
 	mov cr3, eax
 
+	pop gs
+
 	; Restore registers
 	popa ; Pop edi, esi, ebp, esp, ebx, edx, ecx, eax
 
@@ -74,22 +84,23 @@ no_error_code_interrupt_handler 29
 error_code_interrupt_handler    30
 no_error_code_interrupt_handler 31
 
-; why the heck i need those ?
-no_error_code_interrupt_handler 32
-no_error_code_interrupt_handler 33
-no_error_code_interrupt_handler 34
-no_error_code_interrupt_handler 35
-no_error_code_interrupt_handler 36
-no_error_code_interrupt_handler 37
-no_error_code_interrupt_handler 38
-no_error_code_interrupt_handler 39
-no_error_code_interrupt_handler 40
-no_error_code_interrupt_handler 41
-no_error_code_interrupt_handler 42
-no_error_code_interrupt_handler 43
-no_error_code_interrupt_handler 44
-no_error_code_interrupt_handler 45
-no_error_code_interrupt_handler 46
-no_error_code_interrupt_handler 47
-
-no_error_code_interrupt_handler 128 ;for syscalls
\ No newline at end of file
+; irqs, ipis, msi, syscall and spurious: everything else has no error code
+%assign vector 32
+%rep 224
+no_error_code_interrupt_handler vector
+%assign vector vector + 1
+%endrep
+
+; addresses of all the stubs, for setup_idt
+%macro interrupt_stub_entry 1
+	dd interrupt_handler_%1
+%endmacro
+
+section .rodata
+global interrupt_stub_table
+interrupt_stub_table:
+%assign vector 0
+%rep 256
+interrupt_stub_entry vector
+%assign vector vector + 1
+%endrep
@@ -3,6 +3,15 @@
 #include "vmm.h"
 #include <stdint.h>
 #include "syscall.h"
+#include "klog.h"
+#include "ring.h"
+#include "apic.h"
+#include "softirq.h"
+#include "cpu.h"
+#include "task.h"
+#include "smp.h"
+#include "lock.h"
+#include "rcu.h"
 
 struct cpu_state {
     unsigned int edi;
@@ -41,63 +50,34 @@ struct idt_ptr {
 struct idt_entry idt_entries[IDT_TABLE_SZ];
 struct idt_ptr idt_base;
 
-extern void interrupt_handler_0(void);
-extern void interrupt_handler_1(void);
-extern void interrupt_handler_2(void);
-extern void interrupt_handler_3(void);
-extern void interrupt_handler_4(void);
-extern void interrupt_handler_5(void);
-extern void interrupt_handler_6(void);
-extern void interrupt_handler_7(void);
-extern void interrupt_handler_8(void);
-extern void interrupt_handler_9(void);
-extern void interrupt_handler_10(void);
-extern void interrupt_handler_11(void);
-extern void interrupt_handler_12(void);
-extern void interrupt_handler_13(void);
-extern void interrupt_handler_14(void);
-extern void interrupt_handler_15(void);
-extern void interrupt_handler_16(void);
-extern void interrupt_handler_17(void);
-extern void interrupt_handler_18(void);
-extern void interrupt_handler_19(void);
-extern void interrupt_handler_20(void);
-extern void interrupt_handler_21(void);
-extern void interrupt_handler_22(void);
-extern void interrupt_handler_23(void);
-extern void interrupt_handler_24(void);
-extern void interrupt_handler_25(void);
-extern void interrupt_handler_26(void);
-extern void interrupt_handler_27(void);
-extern void interrupt_handler_28(void);
-extern void interrupt_handler_29(void);
-extern void interrupt_handler_30(void);
-extern void interrupt_handler_31(void);
-extern void interrupt_handler_32(void);
-extern void interrupt_handler_33(void);
-extern void interrupt_handler_34(void);
-extern void interrupt_handler_35(void);
-extern void interrupt_handler_36(void);
-extern void interrupt_handler_37(void);
-extern void interrupt_handler_38(void);
-extern void interrupt_handler_39(void);
-extern void interrupt_handler_40(void);
-extern void interrupt_handler_41(void);
-extern void interrupt_handler_42(void);
-extern void interrupt_handler_43(void);
-extern void interrupt_handler_44(void);
-extern void interrupt_handler_45(void);
-extern void interrupt_handler_46(void);
-extern void interrupt_handler_47(void);
-extern void interrupt_handler_128(void);
+extern void *interrupt_stub_table[IDT_TABLE_SZ]; //interrupt.asm
 
-struct inter_holder {
-    unsigned char present;
-    interrupt_type fnc;
+//handlers sharing a vector are chained, all of them are called in turn.
+//The chains are rcu protected: the interrupt path walks them without a
+//lock, a removed action goes back to the pool after a grace period. Only
+//exception handlers may sleep (the page fault one does), they are never
+//unregistered
+struct irq_action {
+    struct irq_action *next;
+    interrupt_type fnc; //0 when the slot is free
     void *ext;
+    struct rcu_head rcu;
+};
+
+struct inter_holder {
+    struct irq_action *actions;
+    uint32_t count;
+    uint32_t spurious; //nobody claimed it
+    uint32_t max_cycles;
+    uint64_t cycles;
 };
 
-struct inter_holder int_reg[48];
+//no heap yet when the first handlers are registered
+#define IRQ_ACTIONS 64
+static struct irq_action irq_action_pool[IRQ_ACTIONS];
+static struct spinlock irq_action_lock = SPINLOCK_INIT("irq_action"); //chain and pool updates
+
+struct inter_holder int_reg[IDT_TABLE_SZ];
 
 void PIC_sendEOI(unsigned char irq);
 void PIC_remap(int offset1, int offset2);
@@ -113,24 +93,93 @@ void PIC_remap(int offset1, int offset2);
 
 struct fullstack {
     unsigned int cr3;
+    unsigned int gs; //the interrupted code's, the stub loads SMP_PERCPU_SEL
     struct cpu_state cpu;
     unsigned int interrupt;
     struct stack_state stack;
 };
 
+//sysenter.asm reaches it with its offset
+_Static_assert(offsetof(struct cpu, interrupt_nesting) == 4, "struct cpu layout");
+
 void interrupt_handler(struct fullstack *fstack) {
-    if (fstack->interrupt < 48 && int_reg[fstack->interrupt].present == 1) {
-        int_reg[fstack->interrupt].fnc(fstack->interrupt, int_reg[fstack->interrupt].ext);
-    } else if(fstack->interrupt == 128) {
+    struct inter_holder *holder = &int_reg[fstack->interrupt % IDT_TABLE_SZ];
+    uint64_t start = 0;
+
+    //the lock holder may be spinning on this one, it can't wait for the lock
+    if (fstack->interrupt == IRQ_IPI_TLB && smp_started) {
+        smp_tlb_interrupt();
+        return;
+    }
+
+    kernel_lock();
+    this_cpu_inc(interrupt_nesting);
+    holder->count++;
+
+    if (fstack->interrupt == IRQ_SPURIOUS && apic_enabled) {
+        //no eoi for those
+        holder->spurious++;
+        this_cpu_dec(interrupt_nesting);
+        kernel_unlock();
+        return;
+    }
+
+    if (cpu_has(CPU_FEATURE_TSC)) {
+        start = rdtsc();
+    }
+
+    if (holder->actions != (void *)0) {
+        int handled = IRQ_NONE;
+        int device = fstack->interrupt >= IRQ_LEGACY_BASE;
+
+        this_cpu_add(irq_handler_depth, device);
+        rcu_read_lock();
+        for (struct irq_action *action = rcu_dereference(holder->actions); action != (void *)0; action = rcu_dereference(action->next)) {
+            handled |= action->fnc(fstack->interrupt, action->ext);
+        }
+        rcu_read_unlock();
+        this_cpu_add(irq_handler_depth, -device);
+
+        if (handled == IRQ_NONE) {
+            holder->spurious++;
+        }
+    } else if(fstack->interrupt == IRQ_SYSCALL) {
         fstack->cpu.eax = syscall_handler(fstack->cpu.eax, fstack->cpu.ebx, fstack->cpu.ecx, fstack->cpu.edx, fstack->cpu.esi, fstack->cpu.edi);
     } else {
         kprintf("CS=0x%8h, int_no=0x%8h, err_code=0x%8h\n", fstack->stack.cs, fstack->interrupt, fstack->stack.error_code);
         kprintf("EDI=0x%8h, ESI=0x%8h, EBP=0x%8h\n", fstack->cpu.edi, fstack->cpu.esi, fstack->cpu.ebp);
         kprintf("ESP=0x%8h, EBX=0x%8h, EDX=0x%8h\n", fstack->cpu.esp, fstack->cpu.ebx, fstack->cpu.edx);
         kprintf("ECX=0x%8h, EAX=0x%8h, EIP=0x%8h\n", fstack->cpu.ecx, fstack->cpu.eax, fstack->stack.eip);
+        holder->spurious++;
     }
 
-    PIC_sendEOI(fstack->interrupt);
+    if (start != 0) {
+        uint64_t cycles = rdtsc() - start;
+        holder->cycles += cycles;
+        if (cycles > holder->max_cycles) {
+            holder->max_cycles = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : cycles;
+        }
+    }
+
+    irq_eoi(fstack->interrupt);
+
+    this_cpu_dec(interrupt_nesting);
+    if (this_cpu_read(interrupt_nesting) == 0) {
+        //only when going back to userspace, the kernel may be in the middle of a vm_map update
+        if ((fstack->stack.cs & 3) == 3) {
+            ring_poll();
+        }
+        //not if we came from code that had interrupts off, it doesn't expect
+        //anything to run behind its back
+        if (fstack->stack.eflags & EFLAGS_IF) {
+            softirq_run();
+        }
+        if ((fstack->stack.cs & 3) == 3) {
+            sched_preempt();
+        }
+    }
+
+    kernel_unlock();
 }
 
 void idt_set_gate(unsigned char num, unsigned int base, unsigned short sel, unsigned char flags) {
@@ -141,68 +190,28 @@ void idt_set_gate(unsigned char num, unsigned int base, unsigned short sel, unsi
     idt_entries[num].flags = flags | 0x60;
 }
 
+//every cpu shares the one table
+void idt_load() {
+    asm volatile("lidt %0" : : "m" (idt_base));
+}
+
 #define PIC1_START_INTERRUPT 0x20
 #define PIC2_START_INTERRUPT 0x28
 
 void setup_idt() {
     memset(int_reg, 0, sizeof(int_reg));
+    memset(irq_action_pool, 0, sizeof(irq_action_pool));
 
-    idt_set_gate(0, (unsigned int)&interrupt_handler_0, 0x08, 0x8E);     
-    idt_set_gate(1, (unsigned int)&interrupt_handler_1, 0x08, 0x8E);     
-    idt_set_gate(2, (unsigned int)&interrupt_handler_2, 0x08, 0x8E);     
-    idt_set_gate(3, (unsigned int)&interrupt_handler_3, 0x08, 0x8E);     
-    idt_set_gate(4, (unsigned int)&interrupt_handler_4, 0x08, 0x8E);     
-    idt_set_gate(5, (unsigned int)&interrupt_handler_5, 0x08, 0x8E);     
-    idt_set_gate(6, (unsigned int)&interrupt_handler_6, 0x08, 0x8E);     
-    idt_set_gate(7, (unsigned int)&interrupt_handler_7, 0x08, 0x8E);     
-    idt_set_gate(8, (unsigned int)&interrupt_handler_8, 0x08, 0x8E);     
-    idt_set_gate(9, (unsigned int)&interrupt_handler_9, 0x08, 0x8E);     
-    idt_set_gate(10, (unsigned int)&interrupt_handler_10, 0x08, 0x8E);     
-    idt_set_gate(11, (unsigned int)&interrupt_handler_11, 0x08, 0x8E);     
-    idt_set_gate(12, (unsigned int)&interrupt_handler_12, 0x08, 0x8E);     
-    idt_set_gate(13, (unsigned int)&interrupt_handler_13, 0x08, 0x8E);     
-    idt_set_gate(14, (unsigned int)&interrupt_handler_14, 0x08, 0x8E);     
-    idt_set_gate(15, (unsigned int)&interrupt_handler_15, 0x08, 0x8E);     
-    idt_set_gate(16, (unsigned int)&interrupt_handler_16, 0x08, 0x8E);     
-    idt_set_gate(17, (unsigned int)&interrupt_handler_17, 0x08, 0x8E);     
-    idt_set_gate(18, (unsigned int)&interrupt_handler_18, 0x08, 0x8E);     
-    idt_set_gate(19, (unsigned int)&interrupt_handler_19, 0x08, 0x8E);     
-    idt_set_gate(20, (unsigned int)&interrupt_handler_20, 0x08, 0x8E);     
-    idt_set_gate(21, (unsigned int)&interrupt_handler_21, 0x08, 0x8E);     
-    idt_set_gate(22, (unsigned int)&interrupt_handler_22, 0x08, 0x8E);     
-    idt_set_gate(23, (unsigned int)&interrupt_handler_23, 0x08, 0x8E);     
-    idt_set_gate(24, (unsigned int)&interrupt_handler_24, 0x08, 0x8E);     
-    idt_set_gate(25, (unsigned int)&interrupt_handler_25, 0x08, 0x8E);     
-    idt_set_gate(26, (unsigned int)&interrupt_handler_26, 0x08, 0x8E);     
-    idt_set_gate(27, (unsigned int)&interrupt_handler_27, 0x08, 0x8E);     
-    idt_set_gate(28, (unsigned int)&interrupt_handler_28, 0x08, 0x8E); 
-    idt_set_gate(29, (unsigned int)&interrupt_handler_29, 0x08, 0x8E);   
-    idt_set_gate(30, (unsigned int)&interrupt_handler_30, 0x08, 0x8E);  
-    idt_set_gate(31, (unsigned int)&interrupt_handler_31, 0x08, 0x8E);
-    idt_set_gate(32, (unsigned int)&interrupt_handler_32, 0x08, 0x8E);
-    idt_set_gate(33, (unsigned int)&interrupt_handler_33, 0x08, 0x8E);
-    idt_set_gate(34, (unsigned int)&interrupt_handler_34, 0x08, 0x8E);
-    idt_set_gate(35, (unsigned int)&interrupt_handler_35, 0x08, 0x8E);
-    idt_set_gate(36, (unsigned int)&interrupt_handler_36, 0x08, 0x8E);
-    idt_set_gate(37, (unsigned int)&interrupt_handler_37, 0x08, 0x8E);
-    idt_set_gate(38, (unsigned int)&interrupt_handler_38, 0x08, 0x8E);
-    idt_set_gate(39, (unsigned int)&interrupt_handler_39, 0x08, 0x8E);
-    idt_set_gate(40, (unsigned int)&interrupt_handler_40, 0x08, 0x8E);
-    idt_set_gate(41, (unsigned int)&interrupt_handler_41, 0x08, 0x8E);
-    idt_set_gate(42, (unsigned int)&interrupt_handler_42, 0x08, 0x8E);
-    idt_set_gate(43, (unsigned int)&interrupt_handler_43, 0x08, 0x8E);
-    idt_set_gate(44, (unsigned int)&interrupt_handler_44, 0x08, 0x8E);
-    idt_set_gate(45, (unsigned int)&interrupt_handler_45, 0x08, 0x8E);
-    idt_set_gate(46, (unsigned int)&interrupt_handler_46, 0x08, 0x8E);
-    idt_set_gate(47, (unsigned int)&interrupt_handler_47, 0x08, 0x8E);
-    idt_set_gate(128, (unsigned int)&interrupt_handler_128, 0x08, 0x8E);
+    for (unsigned int i = 0; i < IDT_TABLE_SZ; i++) {
+        idt_set_gate(i, (unsigned int)interrupt_stub_table[i], 0x08, 0x8E);
+    }
 
     idt_base.base = (unsigned int)&idt_entries;
     idt_base.limit = sizeof(struct idt_entry) * IDT_TABLE_SZ - 1;
 
     PIC_remap(PIC1_START_INTERRUPT, PIC2_START_INTERRUPT); //Remap pic to 0x20 -> 0x28 and 0x28 -> 0x2F to avoid conflicts with cpu exeption
 
-    asm volatile("lidt %0" : : "m" (idt_base));
+    idt_load();
 
     outb(PIC1_DATA, 0xff); //mask all
     outb(PIC2_DATA, 0xff);
@@ -259,24 +268,169 @@ void PIC_remap(int offset1, int offset2) {
     outb(PIC2_DATA, a2);
 }
 
-void register_interrupt(unsigned int intno, interrupt_type fnc, void *ext) {
-    int_reg[intno].fnc = fnc;
-    int_reg[intno].ext = ext;
-    int_reg[intno].present = 1;
+void irq_eoi(unsigned int intno) {
+    if (intno < PIC1_START_INTERRUPT || intno == IRQ_SYSCALL) {
+        return;
+    }
 
+    if (apic_enabled) {
+        lapic_eoi();
+    } else {
+        PIC_sendEOI(intno);
+    }
+}
+
+static void irq_unmask_legacy(unsigned int intno) {
     uint16_t port;
     uint8_t value;
     uint8_t irqline;
-    if (intno >= PIC1_START_INTERRUPT && intno < PIC2_START_INTERRUPT) {
+
+    if (apic_enabled) {
+        ioapic_route_irq(intno - PIC1_START_INTERRUPT, intno, lapic_id());
+        return;
+    }
+
+    if (intno < PIC2_START_INTERRUPT) {
         port = PIC1_DATA;
         irqline = intno - PIC1_START_INTERRUPT;
-    } else if (intno >= PIC2_START_INTERRUPT) {
+    } else {
         port = PIC2_DATA;
         irqline = intno - PIC2_START_INTERRUPT;
-    } else {
-        return;
     }
 
     value = inb(port) & ~(1 << irqline);
     outb(port, value);
-}
\ No newline at end of file
+}
+
+//send a legacy irq to another cpu (by local apic id)
+int irq_set_affinity(unsigned int intno, uint8_t apic_id) {
+    if (!apic_enabled || intno < IRQ_LEGACY_BASE || intno >= IRQ_LEGACY_END) {
+        return (1);
+    }
+
+    return ioapic_route_irq(intno - PIC1_START_INTERRUPT, intno, apic_id);
+}
+
+//the io apic takes over: silence the 8259 and move the irqs already registered
+void interrupt_use_apic() {
+    outb(PIC1_DATA, 0xff);
+    outb(PIC2_DATA, 0xff);
+
+    for (unsigned int intno = IRQ_LEGACY_BASE; intno < IRQ_LEGACY_END; intno++) {
+        if (int_reg[intno].actions != (void *)0) {
+            irq_unmask_legacy(intno);
+        }
+    }
+}
+
+//under irq_action_lock. The action is complete before it is published
+static int irq_action_add(unsigned int intno, interrupt_type fnc, void *ext) {
+    struct irq_action *action = (void *)0;
+    struct irq_action **link;
+
+    for (uint32_t i = 0; i < IRQ_ACTIONS; i++) {
+        if (irq_action_pool[i].fnc == (void *)0) {
+            action = &irq_action_pool[i];
+            break;
+        }
+    }
+
+    if (action == (void *)0) {
+        klog_error("register_interrupt: no free slot for vector 0x%2h\n", intno);
+        return (1);
+    }
+
+    action->next = (void *)0;
+    action->fnc = fnc;
+    action->ext = ext;
+
+    for (link = &int_reg[intno].actions; *link != (void *)0; link = &(*link)->next) {}
+    rcu_assign_pointer(*link, action);
+
+    return (0);
+}
+
+//free vector for a msi/msi-x message, registered to fnc; -1 if none left
+int irq_alloc_vector(interrupt_type fnc, void *ext) {
+    unsigned int flags = spin_lock_irqsave(&irq_action_lock);
+    int vector = -1;
+
+    for (unsigned int intno = IRQ_MSI_BASE; intno < IRQ_MSI_END; intno++) {
+        if (intno != IRQ_SYSCALL && int_reg[intno].actions == (void *)0) {
+            vector = irq_action_add(intno, fnc, ext) == 0 ? (int)intno : -1;
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&irq_action_lock, flags);
+    return vector;
+}
+
+//adds fnc at the end of the vector's chain, 1 if there is no room
+int register_interrupt(unsigned int intno, interrupt_type fnc, void *ext) {
+    if (intno >= IDT_TABLE_SZ) {
+        return (1);
+    }
+
+    unsigned int flags = spin_lock_irqsave(&irq_action_lock);
+    int ret = irq_action_add(intno, fnc, ext);
+    spin_unlock_irqrestore(&irq_action_lock, flags);
+
+    if (ret == 0 && intno >= IRQ_LEGACY_BASE && intno < IRQ_LEGACY_END) {
+        irq_unmask_legacy(intno);
+    }
+
+    return ret;
+}
+
+//no interrupt path walks it anymore, the slot can be reused
+static void irq_action_free(struct rcu_head *head) {
+    struct irq_action *action = container_of(head, struct irq_action, rcu);
+    unsigned int flags = spin_lock_irqsave(&irq_action_lock);
+
+    action->fnc = (void *)0;
+    spin_unlock_irqrestore(&irq_action_lock, flags);
+}
+
+//unlinked now, fnc may still run on another cpu until the grace period ends
+void unregister_interrupt(unsigned int intno, interrupt_type fnc, void *ext) {
+    struct irq_action **link;
+
+    if (intno >= IDT_TABLE_SZ) {
+        return;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&irq_action_lock);
+    for (link = &int_reg[intno].actions; *link != (void *)0; link = &(*link)->next) {
+        struct irq_action *action = *link;
+        if (action->fnc == fnc && action->ext == ext) {
+            rcu_assign_pointer(*link, action->next);
+            call_rcu(&action->rcu, irq_action_free);
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&irq_action_lock, flags);
+}
+
+void interrupt_stats_dump() {
+    kprintf("\n=== INTERRUPTS ===\n");
+    kprintf("vector handlers count spurious max_cycles cycles\n");
+
+    for (uint32_t intno = 0; intno < IDT_TABLE_SZ; intno++) {
+        struct inter_holder *holder = &int_reg[intno];
+        uint32_t handlers = 0;
+
+        if (holder->count == 0) {
+            continue;
+        }
+
+        rcu_read_lock();
+        for (struct irq_action *action = rcu_dereference(holder->actions); action != (void *)0; action = rcu_dereference(action->next)) {
+            handlers++;
+        }
+        rcu_read_unlock();
+
+        kprintf("0x%2h %1d %8d %8d %8d 0x%h%8h\n", intno, handlers, holder->count, holder->spurious,
+                holder->max_cycles, (uint32_t)(holder->cycles >> 32), (uint32_t)holder->cycles);
+    }
+}
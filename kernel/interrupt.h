@@ -1,8 +1,32 @@
 #ifndef __INTERRUPTS__
 #define __INTERRUPTS__
 
-typedef void (*interrupt_type)(unsigned int, void *);
+#include <stdint.h>
 
-void register_interrupt(unsigned int intno, interrupt_type fnc, void *ext);
+//vector layout
+#define IRQ_LEGACY_BASE 0x20 //isa irqs 0-15, through the 8259 or the io apic
+#define IRQ_LEGACY_END 0x30
+#define IRQ_LAPIC_TIMER 0x30
+#define IRQ_IPI_BASE 0x31
+#define IRQ_IPI_RESCHEDULE 0x31
+#define IRQ_IPI_TLB 0x32
+#define IRQ_MSI_BASE 0x40 //up to IRQ_MSI_END, minus the syscall one
+#define IRQ_MSI_END 0xF0
+#define IRQ_SYSCALL 0x80
+#define IRQ_SPURIOUS 0xFF
+
+//what a handler returns, a vector can be shared so it has to tell
+#define IRQ_NONE 0
+#define IRQ_HANDLED 1
+
+typedef int (*interrupt_type)(unsigned int, void *);
+
+int register_interrupt(unsigned int intno, interrupt_type fnc, void *ext);
+void unregister_interrupt(unsigned int intno, interrupt_type fnc, void *ext);
+int irq_alloc_vector(interrupt_type fnc, void *ext);
+void irq_eoi(unsigned int intno);
+int irq_set_affinity(unsigned int intno, uint8_t apic_id);
+void interrupt_use_apic(void);
+void interrupt_stats_dump(void);
 
 #endif
\ No newline at end of file
@@ -46,4 +46,21 @@ static inline void mfence() {
 
 static inline void sfence() {
     asm volatile("sfence" ::: "memory");
-}
\ No newline at end of file
+}
+
+#define EFLAGS_IF 0x200
+
+//disable interrupts, returning the previous eflags for irq_restore
+static inline unsigned int irq_save(void) {
+    unsigned int flags;
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned int flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile("sti" ::: "memory");
+    }
+}
@@ -46,7 +46,11 @@ start:
 	push 0x00000000
 	sub ecx, 0x00001000
 	jge .table_page_loop_4
-	mov DWORD [PAGE_TABLE - 0xc0000000 + 0xB8 * 4], (0x000b8003) ; map VGA video memory
+%assign vga_page 0xB8
+%rep 8
+	mov DWORD [PAGE_TABLE - 0xc0000000 + vga_page * 4], ((vga_page << 12) | 3) ; map VGA video memory (32KB, for hardware scrolling)
+%assign vga_page vga_page + 1
+%endrep
 	mov DWORD [PAGE_TABLE - 0xc0000000 + 0x9 * 4], (0x00009001) ; map mbi memory
 
     ; update page directory address, since eax and ebx is in use, have to use ecx or other register
@@ -74,10 +78,10 @@ loop:
     jmp loop	;this should be non reachable code anyway
 
 global load_gdt
-extern gdt_base
 
-load_gdt:
-	lgdt [gdt_base]
+load_gdt: ; void load_gdt(struct gdt_ptr *gdt)
+	mov eax, [esp + 4]
+	lgdt [eax]
 
 	; enable protected mode
 	mov eax, cr0
@@ -97,8 +101,8 @@ load_gdt:
 
 
 global tss_flush
-tss_flush:
-	mov ax, 0x2b
+tss_flush: ; void tss_flush(unsigned int selector)
+	mov eax, [esp + 4]
 	ltr ax
 	ret
 
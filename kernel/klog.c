@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdarg.h>
+#include "klog.h"
+#include "stdlib.h"
+#include "console.h"
+#include "softirq.h"
+
+// Kernel log: producers only format into a ring of fixed size records,
+// the console gets the text later when klog_flush drains the ring (from the
+// log softirq, and at a few points of kmain).
+//
+// Multi producer / single consumer without locks: a producer reserves a
+// sequence number with a cas on klog_head, fills the record and publishes
+// it by storing seq + 1 in it. The consumer stops at the first record that
+// is not published yet.
+
+#define KLOG_RING_SIZE 128
+#define KLOG_TEXT_SIZE 96
+
+#define HEX_BASE 16
+#define DEC_BASE 10
+#define KPRINTF_BUF_SIZE 30
+
+struct klog_record {
+    uint32_t seq;
+    uint8_t level;
+    uint8_t len;
+    char text[KLOG_TEXT_SIZE];
+};
+
+static struct klog_record klog_ring[KLOG_RING_SIZE];
+static uint32_t klog_head = 0;
+static uint32_t klog_tail = 0;
+static uint32_t klog_dropped = 0;
+static uint8_t klog_draining = 0;
+
+static void klog_work(void *ext __attribute__((unused))) {
+    klog_flush();
+}
+
+static struct work_item klog_work_item = WORK_ITEM_INIT(klog_work, (void *)0);
+
+static void itoa(char *buf, unsigned int c, unsigned int base) {
+    char *p;
+    char *p1;
+    char s;
+    const char *charset = "0123456789abcdef";
+
+    p = buf;
+    while (c != 0) {
+        *p++ = charset[c % base];
+        c /= base;
+    }
+
+    p = buf;
+    while (*p != '\0') {
+        p++;
+    }
+    p--;
+
+    p1 = buf;
+    while (p1 < p) {
+        s = *p1;
+        *p1 = *p;
+        *p = s;
+        --p;
+        ++p1;
+    }
+}
+
+uint32_t kvsnprintf(char *out, uint32_t size, const char *format, va_list ap) {
+    char c;
+    char *p;
+    char buf[KPRINTF_BUF_SIZE];
+    uint32_t len = 0;
+
+    while((c = *format++) != '\0') {
+        if (c != '%') {
+            if (len < size) {
+                out[len++] = c;
+            }
+            continue;
+        }
+
+        c = *format++;
+        if (c == '\0') {
+            break;
+        }
+
+        memset(buf, '\0', KPRINTF_BUF_SIZE);
+        if (c >= '0' && c <= '9') {
+            memset(buf, '0', c - '0');
+            c = *format++;
+        }
+
+        switch (c) {
+            case 'd':
+                itoa(buf, va_arg(ap, unsigned int), DEC_BASE);
+                p = buf;
+                break;
+
+            case 'h':
+                itoa(buf, va_arg(ap, unsigned int), HEX_BASE);
+                p = buf;
+                break;
+
+            case 's':
+                p = va_arg(ap, char *);
+                break;
+
+            default:
+                buf[0] = '\0';
+                p = buf;
+                break;
+        }
+
+        while (*p != '\0' && len < size) {
+            out[len++] = *p++;
+        }
+    }
+
+    return len;
+}
+
+void vklog(int level, const char *format, va_list ap) {
+    struct klog_record *record;
+    uint32_t head;
+
+    for (;;) {
+        head = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+        if (head - __atomic_load_n(&klog_tail, __ATOMIC_ACQUIRE) < KLOG_RING_SIZE) {
+            if (__atomic_compare_exchange_n(&klog_head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+
+        //full: drain it ourself, unless we interrupted the drain, then it's lost
+        if (__atomic_load_n(&klog_draining, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&klog_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        //nor when the flush can't free anything: the oldest record's writer
+        //may be the very code we interrupted
+        uint32_t tail = __atomic_load_n(&klog_tail, __ATOMIC_RELAXED);
+        klog_flush();
+        if (__atomic_load_n(&klog_tail, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_fetch_add(&klog_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    record = &klog_ring[head % KLOG_RING_SIZE];
+    record->level = level;
+    record->len = kvsnprintf(record->text, KLOG_TEXT_SIZE, format, ap);
+    __atomic_store_n(&record->seq, head + 1, __ATOMIC_RELEASE);
+
+    softirq_raise(SOFTIRQ_LOG, &klog_work_item);
+}
+
+void klog(int level, const char *format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    vklog(level, format, ap);
+    va_end(ap);
+}
+
+void (kprintf)(const char *format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    vklog(KLOG_INFO, format, ap);
+    va_end(ap);
+}
+
+void klog_flush() {
+    struct klog_record *record;
+    uint32_t tail;
+
+    //one consumer at a time, a nested flush just leaves it to the outer one
+    if (__atomic_exchange_n(&klog_draining, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    tail = __atomic_load_n(&klog_tail, __ATOMIC_RELAXED);
+    while (tail != __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE)) {
+        record = &klog_ring[tail % KLOG_RING_SIZE];
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break; //still being written
+        }
+
+        console_write(record->text, record->len);
+
+        tail++;
+        __atomic_store_n(&klog_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    uint32_t dropped = __atomic_exchange_n(&klog_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped != 0) {
+        char buf[KPRINTF_BUF_SIZE];
+        uint32_t len = 0;
+
+        memset(buf, '\0', KPRINTF_BUF_SIZE);
+        itoa(buf, dropped, DEC_BASE);
+        while (buf[len] != '\0') {
+            len++;
+        }
+
+        console_write("klog: dropped ", sizeof("klog: dropped ") - 1);
+        console_write(buf, len);
+        console_write("\n", 1);
+    }
+
+    __atomic_store_n(&klog_draining, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,32 @@
+#ifndef __KLOG__
+#define __KLOG__
+
+#include <stdint.h>
+#include <stdarg.h>
+
+#define KLOG_DEBUG 0
+#define KLOG_INFO 1
+#define KLOG_WARN 2
+#define KLOG_ERROR 3
+
+//messages under this level are compiled out (make KLOG_LEVEL=0 for debug)
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL KLOG_INFO
+#endif
+
+void klog(int level, const char *format, ...);
+void vklog(int level, const char *format, va_list ap);
+void klog_flush(void);
+uint32_t kvsnprintf(char *buf, uint32_t size, const char *format, va_list ap);
+
+#define klog_debug(...) do { if (KLOG_DEBUG >= KLOG_LEVEL) klog(KLOG_DEBUG, __VA_ARGS__); } while (0)
+#define klog_info(...) do { if (KLOG_INFO >= KLOG_LEVEL) klog(KLOG_INFO, __VA_ARGS__); } while (0)
+#define klog_warn(...) do { if (KLOG_WARN >= KLOG_LEVEL) klog(KLOG_WARN, __VA_ARGS__); } while (0)
+#define klog_error(...) do { if (KLOG_ERROR >= KLOG_LEVEL) klog(KLOG_ERROR, __VA_ARGS__); } while (0)
+
+//an info message, compiled out like the others. The function stays for
+//the callers that need an address (sysenter.asm)
+void (kprintf)(const char *format, ...);
+#define kprintf(...) klog_info(__VA_ARGS__)
+
+#endif
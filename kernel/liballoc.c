@@ -1,4 +1,5 @@
 #include "liballoc.h"
+#include "heap_profile.h"
 
 /**  Durand's Ridiculously Amazing Super Duper Memory functions.  */
 
@@ -15,7 +16,7 @@
 #define MODE	MODE_BEST
 
 #ifdef DEBUG
-extern void kprintf(const char *format, ...);
+#include "klog.h"
 #endif
 
 
@@ -374,6 +375,9 @@ void *malloc(size_t size)
 
 	ptr = (void*)((unsigned int)tag + sizeof( struct boundary_tag ) );
 
+	#ifdef HEAP_PROFILE
+	tag->site = heap_profile_alloc( __builtin_return_address(0), size );
+	#endif
 
 	
 	#ifdef DEBUG
@@ -411,6 +415,10 @@ void free(void *ptr)
 
 
 
+		#ifdef HEAP_PROFILE
+		heap_profile_free( tag->site, tag->size );
+		#endif
+
 		#ifdef DEBUG
 		l_inuse -= tag->size;
 		kprintf("free: 0x%8h, %1d, %1d\n", ptr, (int)l_inuse / 1024, (int)l_allocated / 1024 );
@@ -486,6 +494,81 @@ void free(void *ptr)
 
 
 
+int heap_trim(void)
+{
+	int index;
+	int released = 0;
+	struct boundary_tag *tag;
+	struct boundary_tag *next;
+
+	// Somebody is in the middle of malloc/free, don't touch the lists.
+	if ( liballoc_lock() != 0 ) return 0;
+
+		for ( index = 0; index < MAXEXP; index++ )
+		{
+			tag = l_freePages[ index ];
+			while ( tag != NULL )
+			{
+				next = tag->next;
+
+				// Only whole blocks can go back, split ones share pages.
+				if ( (tag->split_left == NULL) && (tag->split_right == NULL) )
+				{
+					unsigned int pages = tag->real_size / l_pageSize;
+
+					if ( (tag->real_size % l_pageSize) != 0 ) pages += 1;
+					if ( pages < (unsigned int)l_pageCount ) pages = l_pageCount; // l_pageCount > 0
+
+					remove_tag( tag );
+					l_completePages[ index ] -= 1;
+
+					liballoc_free( tag, pages );
+					released += pages;
+
+					#ifdef DEBUG
+					l_allocated -= pages * l_pageSize;
+					kprintf("Trimming 0x%8h of %1d pages\n", tag, pages );
+					#endif
+				}
+
+				tag = next;
+			}
+		}
+
+	liballoc_unlock();
+	return released;
+}
+
+
+
+void heap_fragmentation(struct heap_frag_report *report)
+{
+	int index;
+	struct boundary_tag *tag;
+
+	liballoc_lock();
+
+		for ( index = 0; index < MAXEXP; index++ )
+		{
+			tag = l_freePages[ index ];
+			while ( tag != NULL )
+			{
+				unsigned int size = tag->real_size - sizeof(struct boundary_tag);
+
+				report->free_lists[ heap_size_class( size ) ] += 1;
+				report->free_blocks += 1;
+				report->free_bytes += size;
+				if ( size > report->largest_free ) report->largest_free = size;
+
+				tag = tag->next;
+			}
+		}
+
+	liballoc_unlock();
+}
+
+
+
 void* calloc(size_t nobj, size_t size)
 {
        int real_size;
@@ -494,6 +577,12 @@ void* calloc(size_t nobj, size_t size)
        real_size = nobj * size;
        
        p = malloc( real_size );
+       if ( p == NULL ) return NULL;
+
+       #ifdef HEAP_PROFILE
+       struct boundary_tag *tag = (struct boundary_tag*)((unsigned int)p - sizeof( struct boundary_tag ));
+       tag->site = heap_profile_reattribute( tag->site, __builtin_return_address(0), tag->size );
+       #endif
 
        liballoc_memset( p, 0, real_size );
 
@@ -523,6 +612,13 @@ void*   realloc(void *p, size_t size)
 	if ( real_size > size ) real_size = size;
 
 	ptr = malloc( size );
+	if ( ptr == NULL ) return NULL;
+
+	#ifdef HEAP_PROFILE
+	tag = (struct boundary_tag*)((unsigned int)ptr - sizeof( struct boundary_tag ));
+	tag->site = heap_profile_reattribute( tag->site, __builtin_return_address(0), tag->size );
+	#endif
+
 	liballoc_memcpy( ptr, p, real_size );
 	free( p );
 
@@ -41,6 +41,10 @@ struct	boundary_tag
 	
 	struct boundary_tag *next;	//< Linked list info.
 	struct boundary_tag *prev;	//< Linked list info.
+
+#ifdef HEAP_PROFILE
+	unsigned short site;		//< Allocation site in heap_profile.c
+#endif
 };
 
 
@@ -89,6 +93,13 @@ void     *realloc(void *, size_t);		//< The standard function.
 void     *calloc(size_t, size_t);		//< The standard function.
 void      free(void *);					//< The standard function.
 
+/** Gives every cached, completely free block back to the system
+ * through liballoc_free. Meant for the memory-pressure path.
+ *
+ * \return the number of pages released.
+ */
+int       heap_trim(void);
+
 
 #ifdef __cplusplus
 }
@@ -2,11 +2,20 @@
 #include "vmm.h"
 #include "pmm.h"
 
+static uint8_t heap_locked = 0;
+
 int liballoc_lock() {
+    //no concurrency yet, this only tells heap_trim that the lists are being touched
+    if (heap_locked) {
+        return 1;
+    }
+
+    heap_locked = 1;
     return 0;
 }
 
 int liballoc_unlock() {
+    heap_locked = 0;
     return 0;
 }
 
@@ -14,7 +23,8 @@ void* liballoc_alloc(int pages) {
     return add_vm_entry(0, pages * PAGE_SIZE, VM_MAP_ANONYMOUS | VM_MAP_WRITE | VM_MAP_KERNEL, (void* )0, 0, 0);
 }
 
-int liballoc_free(void *ptr, int pages) {
+int liballoc_free(void *ptr, int pages __attribute__((unused))) {
+    //unmaps the pages, flushes the tlb and returns the frames to the pmm
     rm_vm_entry(ptr);
     return (0);
 }
\ No newline at end of file
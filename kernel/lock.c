@@ -0,0 +1,356 @@
+#include <stdint.h>
+#include "lock.h"
+#include "smp.h"
+#include "io.h"
+#include "cpu.h"
+#include "stdlib.h"
+
+#ifdef LOCK_STAT
+static struct lock_stat *lock_stats = (void *)0;
+
+static void lock_stat_register(struct lock_stat *stat) {
+    struct lock_stat *head = __atomic_load_n(&lock_stats, __ATOMIC_RELAXED);
+
+    do {
+        stat->next = head;
+    } while (!__atomic_compare_exchange_n(&lock_stats, &head, stat, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//readers may come in together, the counters are atomic
+static void lock_stat_acquired(struct lock_stat *stat, uint32_t spins) {
+    if (__atomic_fetch_add(&stat->acquisitions, 1, __ATOMIC_RELAXED) == 0 && stat->name != (void *)0) {
+        lock_stat_register(stat);
+    }
+
+    if (spins != 0) {
+        __atomic_fetch_add(&stat->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stat->spins, spins, __ATOMIC_RELAXED);
+    }
+}
+
+//exclusive holders only
+static void lock_stat_hold_start(struct lock_stat *stat) {
+    stat->acquired_at = cpu_has(CPU_FEATURE_TSC) ? rdtsc() : 0;
+}
+
+static void lock_stat_hold_end(struct lock_stat *stat) {
+    if (stat->acquired_at == 0) {
+        return;
+    }
+
+    uint64_t cycles = rdtsc() - stat->acquired_at;
+    stat->hold_cycles += cycles;
+    if (cycles > stat->max_hold_cycles) {
+        stat->max_hold_cycles = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : cycles;
+    }
+    stat->acquired_at = 0;
+}
+
+static void lock_stat_init(struct lock_stat *stat, const char *name) {
+    memset(stat, 0, sizeof(struct lock_stat));
+    stat->name = name;
+}
+#endif
+
+void spin_lock_init(struct spinlock *lock, const char *name __attribute__((unused))) {
+    lock->owner = 0;
+    lock->next = 0;
+#ifdef LOCK_STAT
+    lock_stat_init(&lock->stat, name);
+#endif
+}
+
+void spin_lock(struct spinlock *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    uint32_t spins = 0;
+
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        smp_cpu_relax();
+        spins++;
+    }
+
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, spins);
+    lock_stat_hold_start(&lock->stat);
+#else
+    (void)spins;
+#endif
+}
+
+void spin_unlock(struct spinlock *lock) {
+#ifdef LOCK_STAT
+    lock_stat_hold_end(&lock->stat);
+#endif
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+int spin_trylock(struct spinlock *lock) {
+    uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    uint16_t free = owner;
+
+    //only when nobody holds or waits for it: next == owner
+    if (!__atomic_compare_exchange_n(&lock->next, &free, (uint16_t)(owner + 1), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return (0);
+    }
+
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, 0);
+    lock_stat_hold_start(&lock->stat);
+#endif
+    return (1);
+}
+
+unsigned int spin_lock_irqsave(struct spinlock *lock) {
+    unsigned int flags = irq_save();
+
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(struct spinlock *lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void rwlock_init(struct rwlock *lock, const char *name __attribute__((unused))) {
+    lock->value = 0;
+#ifdef LOCK_STAT
+    lock_stat_init(&lock->stat, name);
+#endif
+}
+
+//not recursive: a waiting writer holds new readers back, the nested one included
+void read_lock(struct rwlock *lock) {
+    uint32_t spins = 0;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+        if ((value & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING)) == 0 &&
+            __atomic_compare_exchange_n(&lock->value, &value, value + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        smp_cpu_relax();
+        spins++;
+    }
+
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, spins);
+#else
+    (void)spins;
+#endif
+}
+
+void read_unlock(struct rwlock *lock) {
+    __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+}
+
+void write_lock(struct rwlock *lock) {
+    uint32_t spins = 0;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+        //taking it clears the waiting bit, the other waiting writers set it again
+        if ((value & ~RWLOCK_WRITER_WAITING) == 0 &&
+            __atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if ((value & RWLOCK_WRITER_WAITING) == 0) {
+            __atomic_fetch_or(&lock->value, RWLOCK_WRITER_WAITING, __ATOMIC_RELAXED);
+        }
+
+        smp_cpu_relax();
+        spins++;
+    }
+
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, spins);
+    lock_stat_hold_start(&lock->stat);
+#else
+    (void)spins;
+#endif
+}
+
+void write_unlock(struct rwlock *lock) {
+#ifdef LOCK_STAT
+    lock_stat_hold_end(&lock->stat);
+#endif
+    __atomic_fetch_and(&lock->value, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+unsigned int read_lock_irqsave(struct rwlock *lock) {
+    unsigned int flags = irq_save();
+
+    read_lock(lock);
+    return flags;
+}
+
+void read_unlock_irqrestore(struct rwlock *lock, unsigned int flags) {
+    read_unlock(lock);
+    irq_restore(flags);
+}
+
+unsigned int write_lock_irqsave(struct rwlock *lock) {
+    unsigned int flags = irq_save();
+
+    write_lock(lock);
+    return flags;
+}
+
+void write_unlock_irqrestore(struct rwlock *lock, unsigned int flags) {
+    write_unlock(lock);
+    irq_restore(flags);
+}
+
+void seqlock_init(struct seqlock *lock, const char *name) {
+    lock->sequence = 0;
+    spin_lock_init(&lock->lock, name);
+}
+
+//interrupts stay off: a reader interrupting its own cpu's writer would spin forever
+unsigned int write_seqlock_irqsave(struct seqlock *lock) {
+    unsigned int flags = spin_lock_irqsave(&lock->lock);
+
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); //odd before the data changes
+
+    return flags;
+}
+
+void write_sequnlock_irqrestore(struct seqlock *lock, unsigned int flags) {
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&lock->lock, flags);
+}
+
+void mutex_init(struct mutex *mutex, const char *name __attribute__((unused))) {
+    spin_lock_init(&mutex->lock, (void *)0);
+    mutex->locked = 0;
+    mutex->owner = (void *)0;
+    mutex->waiters.head = (void *)0;
+    mutex->waiters.tail = (void *)0;
+#ifdef LOCK_STAT
+    lock_stat_init(&mutex->stat, name);
+#endif
+}
+
+//sleeps until the mutex is free. Where nothing can sleep (boot code, the
+//idle loop) it halts until the interrupt letting the owner go on instead
+void mutex_lock(struct mutex *mutex) {
+    unsigned int flags = spin_lock_irqsave(&mutex->lock);
+    uint32_t waits = 0;
+
+    while (mutex->locked) {
+        if (sched_can_block()) {
+            wait_queue_sleep_unlock(&mutex->waiters, &mutex->lock);
+        } else {
+            spin_unlock(&mutex->lock);
+            cpu_idle_halt();
+        }
+        waits++;
+        spin_lock(&mutex->lock);
+    }
+
+    mutex->locked = 1;
+    mutex->owner = current;
+#ifdef LOCK_STAT
+    lock_stat_acquired(&mutex->stat, waits);
+    lock_stat_hold_start(&mutex->stat);
+#else
+    (void)waits;
+#endif
+
+    spin_unlock_irqrestore(&mutex->lock, flags);
+}
+
+int mutex_trylock(struct mutex *mutex) {
+    unsigned int flags = spin_lock_irqsave(&mutex->lock);
+    int taken = !mutex->locked;
+
+    if (taken) {
+        mutex->locked = 1;
+        mutex->owner = current;
+#ifdef LOCK_STAT
+        lock_stat_acquired(&mutex->stat, 0);
+        lock_stat_hold_start(&mutex->stat);
+#endif
+    }
+
+    spin_unlock_irqrestore(&mutex->lock, flags);
+    return taken;
+}
+
+void mutex_unlock(struct mutex *mutex) {
+    unsigned int flags = spin_lock_irqsave(&mutex->lock);
+
+#ifdef LOCK_STAT
+    lock_stat_hold_end(&mutex->stat);
+#endif
+    mutex->locked = 0;
+    mutex->owner = (void *)0;
+    wait_queue_wake(&mutex->waiters); //they all check again, one gets it
+
+    spin_unlock_irqrestore(&mutex->lock, flags);
+}
+
+void semaphore_init(struct semaphore *semaphore, int32_t value) {
+    spin_lock_init(&semaphore->lock, (void *)0);
+    semaphore->count = value;
+    semaphore->waiters.head = (void *)0;
+    semaphore->waiters.tail = (void *)0;
+}
+
+//same rules as mutex_lock
+void down(struct semaphore *semaphore) {
+    unsigned int flags = spin_lock_irqsave(&semaphore->lock);
+
+    while (semaphore->count <= 0) {
+        if (sched_can_block()) {
+            wait_queue_sleep_unlock(&semaphore->waiters, &semaphore->lock);
+        } else {
+            spin_unlock(&semaphore->lock);
+            cpu_idle_halt();
+        }
+        spin_lock(&semaphore->lock);
+    }
+    semaphore->count--;
+
+    spin_unlock_irqrestore(&semaphore->lock, flags);
+}
+
+int down_trylock(struct semaphore *semaphore) {
+    unsigned int flags = spin_lock_irqsave(&semaphore->lock);
+    int taken = semaphore->count > 0;
+
+    if (taken) {
+        semaphore->count--;
+    }
+
+    spin_unlock_irqrestore(&semaphore->lock, flags);
+    return taken;
+}
+
+void up(struct semaphore *semaphore) {
+    unsigned int flags = spin_lock_irqsave(&semaphore->lock);
+
+    semaphore->count++;
+    wait_queue_wake(&semaphore->waiters);
+
+    spin_unlock_irqrestore(&semaphore->lock, flags);
+}
+
+void lock_stat_dump() {
+    kprintf("\n=== LOCKS ===\n");
+
+#ifdef LOCK_STAT
+    kprintf("acquisitions contended spins hold_cycles max_hold name\n");
+    for (struct lock_stat *stat = __atomic_load_n(&lock_stats, __ATOMIC_ACQUIRE); stat != (void *)0; stat = stat->next) {
+        kprintf("%8d %8d %8d %8d %8d %s\n", stat->acquisitions, stat->contended, stat->spins,
+                (uint32_t)stat->hold_cycles, stat->max_hold_cycles, stat->name);
+    }
+#else
+    kprintf("not compiled in (LOCK_STAT=1)\n");
+#endif
+}
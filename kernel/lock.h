@@ -0,0 +1,134 @@
+#ifndef __LOCK__
+#define __LOCK__
+
+#include <stdint.h>
+#include "task.h"
+
+// Synchronization primitives:
+//  - spinlock: fifo ticket lock, the _irqsave variants also keep the local
+//    interrupts off (a lock an interrupt handler takes needs them)
+//  - rwlock: spinning, many readers or one writer, a waiting writer stops
+//    new readers
+//  - seqlock: readers take nothing and retry when a writer went through
+//  - mutex, semaphore: sleep on a wait queue, task context only
+// Spinning cpus keep answering tlb shootdowns (smp_cpu_relax). Built with
+// LOCK_STAT the named spinlocks, rwlocks and mutexes count their
+// acquisitions, contended ones, spins (sleeps for a mutex) and hold time
+// (exclusive holders), dumped by lock_stat_dump.
+
+#ifdef LOCK_STAT
+struct lock_stat {
+    const char *name;
+    struct lock_stat *next; //registered on first use
+    uint32_t acquisitions;
+    uint32_t contended;
+    uint32_t spins;
+    uint32_t max_hold_cycles;
+    uint64_t hold_cycles;
+    uint64_t acquired_at;
+};
+
+#define LOCK_STAT_INIT(lock_name) .stat = { .name = (lock_name) },
+#else
+#define LOCK_STAT_INIT(lock_name)
+#endif
+
+struct spinlock {
+    volatile uint16_t owner; //ticket being served
+    volatile uint16_t next; //next ticket handed out
+#ifdef LOCK_STAT
+    struct lock_stat stat;
+#endif
+};
+
+#define RWLOCK_WRITER 0x80000000
+#define RWLOCK_WRITER_WAITING 0x40000000
+
+struct rwlock {
+    volatile uint32_t value; //readers count, RWLOCK_WRITER, RWLOCK_WRITER_WAITING
+#ifdef LOCK_STAT
+    struct lock_stat stat;
+#endif
+};
+
+struct seqlock {
+    volatile uint32_t sequence; //odd while a writer is in
+    struct spinlock lock; //between writers
+};
+
+struct mutex {
+    struct spinlock lock; //the fields below
+    uint8_t locked;
+    struct task *owner;
+    struct wait_queue waiters;
+#ifdef LOCK_STAT
+    struct lock_stat stat;
+#endif
+};
+
+struct semaphore {
+    struct spinlock lock;
+    int32_t count;
+    struct wait_queue waiters;
+};
+
+#define SPINLOCK_INIT(name) { .owner = 0, .next = 0, LOCK_STAT_INIT(name) }
+#define RWLOCK_INIT(name) { .value = 0, LOCK_STAT_INIT(name) }
+#define SEQLOCK_INIT(name) { .sequence = 0, .lock = SPINLOCK_INIT(name) }
+#define MUTEX_INIT(name) { .lock = SPINLOCK_INIT((void *)0), .locked = 0, .owner = (void *)0, .waiters = { (void *)0, (void *)0 }, LOCK_STAT_INIT(name) }
+#define SEMAPHORE_INIT(value) { .lock = SPINLOCK_INIT((void *)0), .count = (value), .waiters = { (void *)0, (void *)0 } }
+
+void spin_lock_init(struct spinlock *lock, const char *name);
+void spin_lock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
+int spin_trylock(struct spinlock *lock); //1 when taken
+unsigned int spin_lock_irqsave(struct spinlock *lock);
+void spin_unlock_irqrestore(struct spinlock *lock, unsigned int flags);
+
+static inline int spin_is_locked(struct spinlock *lock) {
+    return lock->owner != lock->next;
+}
+
+void rwlock_init(struct rwlock *lock, const char *name);
+void read_lock(struct rwlock *lock);
+void read_unlock(struct rwlock *lock);
+void write_lock(struct rwlock *lock);
+void write_unlock(struct rwlock *lock);
+unsigned int read_lock_irqsave(struct rwlock *lock);
+void read_unlock_irqrestore(struct rwlock *lock, unsigned int flags);
+unsigned int write_lock_irqsave(struct rwlock *lock);
+void write_unlock_irqrestore(struct rwlock *lock, unsigned int flags);
+
+void seqlock_init(struct seqlock *lock, const char *name);
+unsigned int write_seqlock_irqsave(struct seqlock *lock);
+void write_sequnlock_irqrestore(struct seqlock *lock, unsigned int flags);
+
+//do { seq = read_seqbegin(&lock); ...copy... } while (read_seqretry(&lock, seq));
+static inline uint32_t read_seqbegin(struct seqlock *lock) {
+    uint32_t sequence;
+
+    while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        asm volatile("pause" ::: "memory");
+    }
+
+    return sequence;
+}
+
+static inline int read_seqretry(struct seqlock *lock, uint32_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return lock->sequence != sequence;
+}
+
+void mutex_init(struct mutex *mutex, const char *name);
+void mutex_lock(struct mutex *mutex);
+int mutex_trylock(struct mutex *mutex); //1 when taken
+void mutex_unlock(struct mutex *mutex);
+
+void semaphore_init(struct semaphore *semaphore, int32_t value);
+void down(struct semaphore *semaphore);
+int down_trylock(struct semaphore *semaphore); //1 when taken
+void up(struct semaphore *semaphore);
+
+void lock_stat_dump(void);
+
+#endif
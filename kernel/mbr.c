@@ -3,6 +3,7 @@
 #include "stdlib.h"
 #define _HAVE_SIZE_T
 #include "liballoc.h"
+#include "arena.h"
 struct mbr_entry {
     uint8_t drive_attribute;
     uint8_t chs_start[3];
@@ -53,25 +54,35 @@ struct bdev_operation mbr_partition_ops = {
 };
 
 enum bdev_payload_status mbr_init(uint8_t drive) {
-    uint8_t buffer[512];
-    struct mbr *mbr = (struct mbr *)(&buffer[0x1b8]);
+    struct arena *scratch = arena_scratch();
+    arena_mark_t mark = arena_mark(scratch);
+    enum bdev_payload_status status = BDEV_FORWARD;
+    uint8_t *buffer;
+    struct mbr *mbr;
     uint8_t valid = 0;
 
     kprintf("mbr init drive %1d\n", drive);
 
+    buffer = arena_alloc_aligned(scratch, 512, ARENA_SECTOR_ALIGN);
+    if (buffer == (void *)0) {
+        return BDEV_ERROR;
+    }
+    mbr = (struct mbr *)(&buffer[0x1b8]);
+
     if (bdev_read(drive, 1, 0, buffer) != 0) {
         kprintf("bdev_read error\n");
-        return BDEV_ERROR;
+        status = BDEV_ERROR;
+        goto out;
     }
 
     if (mbr->signature != 0xAA55) {
         kprintf("mbr sig lol (0x%4h)\n", mbr->signature);
-        return BDEV_FORWARD;
+        goto out;
     }
 
     if (mbr->uuid == last_uuid) {
         kprintf("last uuid\n");
-        return BDEV_FORWARD;
+        goto out;
     }
 
     last_uuid = mbr->uuid;
@@ -86,7 +97,11 @@ enum bdev_payload_status mbr_init(uint8_t drive) {
                 continue;
         }
 
-        struct mbr_partition *part = (struct mbr_partition *)malloc(sizeof(struct mbr_partition));
+        //partitions live as long as the kernel, no need for the general heap
+        struct mbr_partition *part = (struct mbr_partition *)arena_alloc(&boot_arena, sizeof(struct mbr_partition));
+        if (part == (void *)0) {
+            part = (struct mbr_partition *)malloc(sizeof(struct mbr_partition));
+        }
         part->lba_start = mbr->entries[i].lba_start;
         part->num_sector = mbr->entries[i].num_sectors;
         part->drive = drive;
@@ -95,11 +110,12 @@ enum bdev_payload_status mbr_init(uint8_t drive) {
         bdev_register(&mbr_partition_ops, part);
     }
 
-    if (valid == 0) {
-        return BDEV_FORWARD;
+    if (valid != 0) {
+        kprintf("bdev setup ok\n");
+        status = BDEV_SUCCESS;
     }
 
-    kprintf("bdev setup ok\n");
-
-    return BDEV_SUCCESS;
+out:
+    arena_reset(scratch, mark);
+    return status;
 }
\ No newline at end of file
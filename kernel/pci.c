@@ -3,6 +3,11 @@
 #include "pci.h"
 #include "ata.h"
 #include "virtio_blk.h"
+#include "vmm.h"
+#include "apic.h"
+#include "lock.h"
+#include "rcu.h"
+#include "liballoc.h"
 
 #define PCI_BSFO_TO_ADDRESS(bus, slot, func, offset)                                                                   \
 	(((uint32_t)((uint32_t)(bus) << 16) | ((uint32_t)(slot) << 11) | (uint32_t)(func) << 8) |                        \
@@ -12,7 +17,33 @@
 
 #define PCI_UNKNOWN_VENDOR_ID 0xFFFF
 
-extern void kprintf(const char *format, ...);
+#define PCI_COMMAND 0x04
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+#define PCI_STATUS_CAP_LIST 0x0010
+#define PCI_CAP_PTR 0x34
+#define PCI_BAR0 0x10
+#define PCI_MAX_CAPS 48
+
+#define MSI_CONTROL_ENABLE 0x0001
+#define MSI_CONTROL_MULTIPLE 0x0070
+#define MSI_CONTROL_64BIT 0x0080
+#define MSIX_CONTROL_TABLE_SIZE 0x07FF
+#define MSIX_CONTROL_MASK_ALL 0x4000
+#define MSIX_CONTROL_ENABLE 0x8000
+#define MSIX_TABLE_BIR 0x7
+
+#define MSIX_ENTRY_ADDRESS_LOW 0
+#define MSIX_ENTRY_ADDRESS_HIGH 1
+#define MSIX_ENTRY_DATA 2
+#define MSIX_ENTRY_CONTROL 3
+#define MSIX_ENTRY_MASKED 0x1
+
+//message to the local apic, fixed delivery, edge
+#define MSI_ADDRESS(apic_id) (0xFEE00000 | ((uint32_t)(apic_id) << 12))
+
+#include "klog.h"
 
 struct pci_driver {
 	uint8_t class;
@@ -20,12 +51,15 @@ struct pci_driver {
 	driver_init init;
 };
 
-struct pci_driver pci_drivers[] = {
-    //{0x01, 0x01, ata_init},
-	{0x01, 0x00, virtio_blk_init},
+//rcu: the scan reads it, pci_register_driver publishes a new version
+struct pci_drivers {
+	struct rcu_head rcu;
+	uint32_t count;
+	struct pci_driver drivers[];
 };
 
-uint32_t pci_drivers_sz = sizeof(pci_drivers) / sizeof(struct pci_driver);
+static struct pci_drivers *pci_drivers = (void *)0;
+static struct spinlock pci_drivers_lock = SPINLOCK_INIT("pci_drivers");
 
 static void pci_config_read_header(struct pci_header *head, uint8_t bus, uint8_t slot, uint8_t fonc);
 static void pci_scan_device(uint8_t bus, uint8_t device);
@@ -39,6 +73,121 @@ uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset
 	return inl(PCI_CONFIG_DATA);
 }
 
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset, uint32_t value) {
+	uint32_t address = PCI_BSFO_TO_ADDRESS(bus, slot, fonc, offset) | 0x80000000;
+
+	outl(PCI_CONFIG_ADDRESS, address);
+	outl(PCI_CONFIG_DATA, value);
+}
+
+static uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset) {
+	return pci_config_read(bus, slot, fonc, offset) >> ((offset & 2) * 8);
+}
+
+static void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset, uint16_t value) {
+	uint32_t dword = pci_config_read(bus, slot, fonc, offset);
+	uint32_t shift = (offset & 2) * 8;
+
+	dword = (dword & ~(0xFFFF << shift)) | ((uint32_t)value << shift);
+	pci_config_write(bus, slot, fonc, offset, dword);
+}
+
+//offset of the capability in config space, 0 if the device doesn't have it
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t cap_id) {
+	if ((pci_config_read(bus, slot, fonc, PCI_COMMAND) >> 16 & PCI_STATUS_CAP_LIST) == 0) {
+		return (0);
+	}
+
+	uint8_t offset = pci_config_read(bus, slot, fonc, PCI_CAP_PTR) & 0xFC;
+	for (uint32_t i = 0; i < PCI_MAX_CAPS && offset != 0; i++) {
+		uint32_t cap = pci_config_read(bus, slot, fonc, offset);
+		if ((cap & 0xFF) == cap_id) {
+			return offset;
+		}
+		offset = (cap >> 8) & 0xFC;
+	}
+
+	return (0);
+}
+
+//legacy irq line off, the device raises the message instead
+static void pci_disable_intx(uint8_t bus, uint8_t slot, uint8_t fonc) {
+	uint16_t command = pci_config_read16(bus, slot, fonc, PCI_COMMAND);
+	//status is the upper half and its bits are write one to clear: write 0 there
+	pci_config_write(bus, slot, fonc, PCI_COMMAND, command | PCI_COMMAND_INTX_DISABLE | PCI_COMMAND_MASTER);
+}
+
+//single message msi on vector, sent to this cpu
+int pci_enable_msi(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t vector) {
+	uint8_t cap = pci_find_capability(bus, slot, fonc, PCI_CAP_MSI);
+	if (cap == 0 || !apic_enabled) {
+		return (1);
+	}
+
+	uint16_t control = pci_config_read16(bus, slot, fonc, cap + 2);
+	pci_config_write(bus, slot, fonc, cap + 4, MSI_ADDRESS(lapic_id()));
+	if (control & MSI_CONTROL_64BIT) {
+		pci_config_write(bus, slot, fonc, cap + 8, 0);
+		pci_config_write16(bus, slot, fonc, cap + 12, vector);
+	} else {
+		pci_config_write16(bus, slot, fonc, cap + 8, vector);
+	}
+
+	control = (control & ~MSI_CONTROL_MULTIPLE) | MSI_CONTROL_ENABLE;
+	pci_config_write16(bus, slot, fonc, cap + 2, control);
+	pci_disable_intx(bus, slot, fonc);
+
+	return (0);
+}
+
+//map the msi-x table and turn it on with every entry masked, entries are
+//then given a vector with pci_msix_set_vector
+int pci_enable_msix(uint8_t bus, uint8_t slot, uint8_t fonc, struct pci_msix *msix) {
+	uint8_t cap = pci_find_capability(bus, slot, fonc, PCI_CAP_MSIX);
+	if (cap == 0 || !apic_enabled) {
+		return (1);
+	}
+
+	uint16_t control = pci_config_read16(bus, slot, fonc, cap + 2);
+	uint32_t table = pci_config_read(bus, slot, fonc, cap + 4);
+	uint32_t bar = pci_config_read(bus, slot, fonc, PCI_BAR0 + 4 * (table & MSIX_TABLE_BIR));
+	if (bar & 1) {
+		return (2); //the table must be in memory space
+	}
+
+	msix->size = (control & MSIX_CONTROL_TABLE_SIZE) + 1;
+	msix->table = vmm_map_phys(0, (bar & ~0xF) + (table & ~MSIX_TABLE_BIR), msix->size * 16, VM_MAP_KERNEL | VM_MAP_WRITE | VM_MAP_NOCACHE);
+	if (msix->table == (void *)0) {
+		return (3);
+	}
+
+	uint16_t command = pci_config_read16(bus, slot, fonc, PCI_COMMAND);
+	pci_config_write(bus, slot, fonc, PCI_COMMAND, command | PCI_COMMAND_MEMORY);
+
+	for (uint32_t i = 0; i < msix->size; i++) {
+		msix->table[i * 4 + MSIX_ENTRY_CONTROL] |= MSIX_ENTRY_MASKED;
+	}
+
+	pci_config_write16(bus, slot, fonc, cap + 2, (control & ~MSIX_CONTROL_MASK_ALL) | MSIX_CONTROL_ENABLE);
+	pci_disable_intx(bus, slot, fonc);
+
+	return (0);
+}
+
+int pci_msix_set_vector(struct pci_msix *msix, uint32_t entry, uint8_t vector) {
+	if (entry >= msix->size) {
+		return (1);
+	}
+
+	volatile uint32_t *slot = &msix->table[entry * 4];
+	slot[MSIX_ENTRY_ADDRESS_LOW] = MSI_ADDRESS(lapic_id());
+	slot[MSIX_ENTRY_ADDRESS_HIGH] = 0;
+	slot[MSIX_ENTRY_DATA] = vector;
+	slot[MSIX_ENTRY_CONTROL] &= ~MSIX_ENTRY_MASKED;
+
+	return (0);
+}
+
 static void pci_config_read_header(struct pci_header *head, uint8_t bus, uint8_t slot, uint8_t fonc) {
 	uint32_t *buffer = (uint32_t *)head;
 	uint32_t index;
@@ -87,10 +236,65 @@ static void pci_print_header(struct pci_header *head) {
 		  head->device_id, head->class, head->subclass);
 }
 
+static void pci_drivers_rcu_free(struct rcu_head *head) {
+	free(container_of(head, struct pci_drivers, rcu));
+}
+
+//drivers built in, before the scan
+void pci_init() {
+	//pci_register_driver(0x01, 0x01, ata_init);
+	pci_register_driver(0x01, 0x00, virtio_blk_init);
+}
+
+//probed on the devices of that class found by the next scans
+int pci_register_driver(uint8_t class, uint8_t subclass, driver_init init) {
+	unsigned int flags = spin_lock_irqsave(&pci_drivers_lock);
+	struct pci_drivers *old = pci_drivers;
+	uint32_t count = old != (void *)0 ? old->count : 0;
+	struct pci_drivers *new = malloc(sizeof(struct pci_drivers) + (count + 1) * sizeof(struct pci_driver));
+
+	if (new == (void *)0) {
+		spin_unlock_irqrestore(&pci_drivers_lock, flags);
+		return (1);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		new->drivers[i] = old->drivers[i];
+	}
+	new->drivers[count].class = class;
+	new->drivers[count].subclass = subclass;
+	new->drivers[count].init = init;
+	new->count = count + 1;
+
+	rcu_assign_pointer(pci_drivers, new);
+	if (old != (void *)0) {
+		call_rcu(&old->rcu, pci_drivers_rcu_free);
+	}
+
+	spin_unlock_irqrestore(&pci_drivers_lock, flags);
+	return (0);
+}
+
+//the init functions sleep (disk i/o), they are called outside of the read side section
 static void pci_init_device(struct pci_header *head, uint8_t bus, uint8_t slot, uint8_t fonc) {
-	for (uint32_t i = 0; i < pci_drivers_sz; i++) {
-		if (head->class == pci_drivers[i].class && head->subclass == pci_drivers[i].subclass) {
-			pci_drivers[i].init(head, bus, slot, fonc);
+	for (uint32_t i = 0;; i++) {
+		driver_init init = (void *)0;
+		uint8_t match = 0;
+
+		rcu_read_lock();
+		struct pci_drivers *table = rcu_dereference(pci_drivers);
+		if (table == (void *)0 || i >= table->count) {
+			rcu_read_unlock();
+			return;
+		}
+		if (head->class == table->drivers[i].class && head->subclass == table->drivers[i].subclass) {
+			init = table->drivers[i].init;
+			match = 1;
+		}
+		rcu_read_unlock();
+
+		if (match) {
+			init(head, bus, slot, fonc);
 		}
 	}
 }
\ No newline at end of file
@@ -38,9 +38,24 @@ struct pci_header {
 	} __attribute__((packed)) specific;
 } __attribute__((packed));
 
+#define PCI_CAP_MSI 0x05
+#define PCI_CAP_MSIX 0x11
+
+struct pci_msix {
+	volatile uint32_t *table;
+	uint32_t size;
+};
+
 typedef void (*driver_init)(struct pci_header *, uint8_t, uint8_t, uint8_t);
 
+void pci_init(void);
+int pci_register_driver(uint8_t class, uint8_t subclass, driver_init init);
 void pci_scan_bus(uint8_t bus);
 uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset);
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t offset, uint32_t value);
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t cap_id);
+int pci_enable_msi(uint8_t bus, uint8_t slot, uint8_t fonc, uint8_t vector);
+int pci_enable_msix(uint8_t bus, uint8_t slot, uint8_t fonc, struct pci_msix *msix);
+int pci_msix_set_vector(struct pci_msix *msix, uint32_t entry, uint8_t vector);
 
 #endif
\ No newline at end of file
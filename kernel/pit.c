@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include "pit.h"
+#include "io.h"
+#include "stdlib.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE 0x61
+#define PIT_GATE_ENABLE 0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_OUT2 0x20
+
+//command: channel in bits 6-7, lobyte/hibyte access, mode in bits 1-3
+#define PIT_CMD_CHANNEL0 0x00
+#define PIT_CMD_CHANNEL2 0x80
+#define PIT_CMD_LOHI 0x30
+#define PIT_MODE_ONESHOT 0x00 //mode 0, interrupt on terminal count
+#define PIT_MODE_RATE 0x04 //mode 2, rate generator
+
+static uint8_t pit_gate_saved;
+
+static uint32_t pit_count(uint32_t ms) {
+    return min(max(ms * (PIT_FREQUENCY / 1000), 1), PIT_MAX_COUNT);
+}
+
+void pit_oneshot(uint32_t ms) {
+    uint32_t count = pit_count(ms);
+
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LOHI | PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+void pit_periodic(uint32_t hz) {
+    uint32_t count = min(PIT_FREQUENCY / hz, PIT_MAX_COUNT);
+
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LOHI | PIT_MODE_RATE);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+//ms is at most PIT_MAX_MS
+void pit_gate_start(uint32_t ms) {
+    uint32_t count = pit_count(ms);
+
+    pit_gate_saved = inb(PIT_GATE);
+
+    //gate low, speaker off, then channel 2 in mode 0 (count once)
+    outb(PIT_GATE, (pit_gate_saved & ~PIT_GATE_SPEAKER) & ~PIT_GATE_ENABLE);
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL2 | PIT_CMD_LOHI | PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    outb(PIT_GATE, (pit_gate_saved & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+}
+
+int pit_gate_done() {
+    return (inb(PIT_GATE) & PIT_GATE_OUT2) != 0;
+}
+
+void pit_gate_stop() {
+    outb(PIT_GATE, pit_gate_saved);
+}
+
+//busy wait, for when nothing can wake us up
+void pit_delay(uint32_t ms) {
+    while (ms > 0) {
+        uint32_t chunk = min(ms, PIT_MAX_MS);
+
+        pit_gate_start(chunk);
+        while (!pit_gate_done()) {}
+        pit_gate_stop();
+
+        ms -= chunk;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef __PIT__
+#define __PIT__
+
+#include <stdint.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_INTERRUPT 0x20 //irq 0
+#define PIT_MAX_COUNT 0xFFFF
+#define PIT_MAX_MS (PIT_MAX_COUNT * 1000 / PIT_FREQUENCY)
+
+//channel 0, wired to irq 0
+void pit_oneshot(uint32_t ms);
+void pit_periodic(uint32_t hz);
+
+//channel 2, polled through port 0x61: a known interval for calibrations
+void pit_gate_start(uint32_t ms);
+int pit_gate_done(void);
+void pit_gate_stop(void);
+void pit_delay(uint32_t ms);
+
+#endif
@@ -39,14 +39,13 @@ int bitmap_page_status(physaddr_t page) {
 }
 
 physaddr_t bitmap_find_free_page() {
+    const uint32_t *words = (const uint32_t *)bitmap;
     uint32_t index;
-    uint32_t jndex;
-    
-    for (index = 0; index < PAGE_SIZE; index++) {
-        for (jndex = 0; jndex < BITS_IN_BYTE; jndex++) {
-            if ((bitmap[index] & (1 << jndex)) != 0) {
-                return (index * BITS_IN_BYTE + jndex) * PAGE_SIZE;    
-            }
+
+    //a dword at a time, bsf finds the page inside it
+    for (index = 0; index < PAGE_SIZE / sizeof(uint32_t); index++) {
+        if (words[index] != 0) {
+            return (index * BITS_IN_BYTE * sizeof(uint32_t) + __builtin_ctz(words[index])) * PAGE_SIZE;
         }
     }
 
@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include "rcu.h"
+#include "smp.h"
+#include "lock.h"
+#include "softirq.h"
+#include "interrupt.h"
+#include "io.h"
+#include "stdlib.h"
+
+// One grace period at a time. It starts when a callback is queued: every
+// online cpu gets rcu_qs_pending and the others are kicked with a
+// reschedule ipi, so an idle or userspace one doesn't hold it back. Each
+// cpu clears its flag at its next quiescent point, the last one completes
+// the grace period and hands the callbacks that waited for it to the rcu
+// softirq. A callback queued during a grace period waits for the next one,
+// readers may have seen the old version after that one started.
+
+static struct spinlock rcu_lock = SPINLOCK_INIT("rcu");
+static uint32_t rcu_completed = 0; //grace periods
+static uint8_t rcu_gp_active = 0;
+static uint32_t rcu_gp_waiting = 0; //cpus yet to pass a quiescent state
+
+static struct rcu_head *rcu_pending = (void *)0; //by grace period, oldest first
+static struct rcu_head **rcu_pending_tail = &rcu_pending;
+static struct rcu_head *rcu_done = (void *)0;
+static uint32_t rcu_queued = 0;
+static uint32_t rcu_invoked = 0;
+
+static void rcu_invoke(void *ext);
+static struct work_item rcu_work = WORK_ITEM_INIT(rcu_invoke, (void *)0);
+
+//under rcu_lock
+static void rcu_start_gp(void) {
+    struct cpu *self = this_cpu();
+
+    rcu_gp_active = 1;
+    rcu_gp_waiting = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].online) {
+            cpus[i].rcu_qs_pending = 1;
+            rcu_gp_waiting++;
+        }
+    }
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (&cpus[i] != self && cpus[i].online) {
+            smp_send_ipi(&cpus[i], IRQ_IPI_RESCHEDULE);
+        }
+    }
+}
+
+//under rcu_lock
+static void rcu_end_gp(void) {
+    rcu_completed++;
+    rcu_gp_active = 0;
+
+    struct rcu_head **done_tail = &rcu_done;
+    while (*done_tail != (void *)0) {
+        done_tail = &(*done_tail)->next;
+    }
+
+    while (rcu_pending != (void *)0 && (int32_t)(rcu_completed - rcu_pending->gp) >= 0) {
+        struct rcu_head *head = rcu_pending;
+
+        rcu_pending = head->next;
+        head->next = (void *)0;
+        *done_tail = head;
+        done_tail = &head->next;
+    }
+    if (rcu_pending == (void *)0) {
+        rcu_pending_tail = &rcu_pending;
+    }
+
+    if (rcu_done != (void *)0) {
+        softirq_raise(SOFTIRQ_RCU, &rcu_work);
+    }
+    if (rcu_pending != (void *)0) {
+        rcu_start_gp();
+    }
+}
+
+static void rcu_invoke(void *ext __attribute__((unused))) {
+    unsigned int flags = spin_lock_irqsave(&rcu_lock);
+    struct rcu_head *head = rcu_done;
+
+    rcu_done = (void *)0;
+    spin_unlock_irqrestore(&rcu_lock, flags);
+
+    while (head != (void *)0) {
+        struct rcu_head *next = head->next;
+
+        head->fnc(head);
+        rcu_invoked++;
+        head = next;
+    }
+}
+
+//fnc(head) runs from a softirq once every reader that could see the old
+//version is done. Callable from anywhere, interrupt handlers included
+void call_rcu(struct rcu_head *head, void (*fnc)(struct rcu_head *head)) {
+    unsigned int flags = spin_lock_irqsave(&rcu_lock);
+
+    head->fnc = fnc;
+    head->next = (void *)0;
+    head->gp = rcu_completed + (rcu_gp_active ? 2 : 1);
+    *rcu_pending_tail = head;
+    rcu_pending_tail = &head->next;
+    rcu_queued++;
+
+    if (!rcu_gp_active) {
+        rcu_start_gp();
+    }
+
+    spin_unlock_irqrestore(&rcu_lock, flags);
+}
+
+//this cpu holds no reference. A flag test when no grace period waits on it
+void rcu_note_qs() {
+    if (!this_cpu_read(rcu_qs_pending)) {
+        return;
+    }
+
+    struct cpu *cpu = this_cpu();
+    unsigned int flags = spin_lock_irqsave(&rcu_lock);
+
+    if (cpu->rcu_qs_pending) {
+        cpu->rcu_qs_pending = 0;
+        if (--rcu_gp_waiting == 0) {
+            rcu_end_gp();
+        }
+    }
+
+    spin_unlock_irqrestore(&rcu_lock, flags);
+}
+
+struct rcu_sync {
+    struct rcu_head head;
+    struct wait_queue queue;
+    volatile uint8_t done;
+};
+
+static void rcu_sync_wakeup(struct rcu_head *head) {
+    struct rcu_sync *sync = container_of(head, struct rcu_sync, head);
+
+    sync->done = 1;
+    wait_queue_wake(&sync->queue);
+}
+
+//waits for a whole grace period. Not from a read side section nor an
+//interrupt handler: where the task can't sleep (boot code) this cpu's
+//quiescent state is noted here and the cpu halts until the callback ran
+void synchronize_rcu() {
+    struct rcu_sync sync = { .queue = { (void *)0, (void *)0 }, .done = 0 };
+    unsigned int flags = irq_save();
+
+    call_rcu(&sync.head, rcu_sync_wakeup);
+    while (!sync.done) {
+        if (sched_can_block()) {
+            wait_queue_sleep(&sync.queue);
+        } else {
+            rcu_note_qs();
+            softirq_run();
+            if (!sync.done) {
+                cpu_idle_halt();
+            }
+        }
+    }
+
+    irq_restore(flags);
+}
+
+void rcu_dump() {
+    kprintf("rcu: %d grace periods%s, %d callbacks queued, %d invoked\n", rcu_completed,
+            rcu_gp_active ? " (one running)" : "", rcu_queued, rcu_invoked);
+}
@@ -0,0 +1,39 @@
+#ifndef __RCU__
+#define __RCU__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Quiescent state based rcu for read mostly tables (bdev, payloads, pci
+// drivers, interrupt chains). Readers only mark their section, no lock nor
+// atomic; they must not sleep inside it (copy what is needed, leave, then
+// call). Updaters publish a new version with rcu_assign_pointer and free
+// the old one from call_rcu, once every cpu went through a quiescent
+// state: a context switch, the idle loop or a return to userspace.
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*fnc)(struct rcu_head *head);
+    uint32_t gp; //grace period that has to complete first
+};
+
+#define container_of(ptr, type, member) ((type *)((uint8_t *)(ptr) - offsetof(type, member)))
+
+#define rcu_dereference(p) (*(__typeof__(p) volatile *)&(p))
+#define rcu_assign_pointer(p, value) __atomic_store_n(&(p), (value), __ATOMIC_RELEASE)
+
+//nothing to do, the kernel is not preempted: keeps the compiler from moving loads out
+static inline void rcu_read_lock(void) {
+    asm volatile("" ::: "memory");
+}
+
+static inline void rcu_read_unlock(void) {
+    asm volatile("" ::: "memory");
+}
+
+void call_rcu(struct rcu_head *head, void (*fnc)(struct rcu_head *head));
+void synchronize_rcu(void);
+void rcu_note_qs(void);
+void rcu_dump(void);
+
+#endif
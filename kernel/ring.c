@@ -0,0 +1,225 @@
+#include <stdint.h>
+#include "ring.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "stdlib.h"
+#include "console.h"
+#include "serial.h"
+#include "klog.h"
+#include "task.h"
+#include "liballoc.h"
+
+// io_uring like batching: userspace fills sqes and moves sq_tail, one
+// ring_enter (or the poller with RING_SETUP_SQPOLL) runs all of them and
+// posts a cqe for each. Operations complete synchronously, so min_complete
+// is always met once the submissions are consumed.
+//
+// Everything in the shared header can be scribbled on by userspace: the
+// kernel keeps its own copy of the indexes it owns and only publishes them.
+
+#define RING_USER_HINT ((void *)0x40000000)
+#define RING_MAX_MAPPINGS 16
+
+struct ring {
+    struct ring_header *header;
+    struct ring_sqe *sqes;
+    struct ring_cqe *cqes;
+    void *mappings[RING_MAX_MAPPINGS]; //RING_OP_MMAP's, the only ones RING_OP_MUNMAP takes
+    uint32_t sq_head;
+    uint32_t cq_tail;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+};
+
+static int32_t ring_op_write(const struct ring_sqe *sqe) {
+    if (__check_ptr_userspace((const void *)sqe->addr, sqe->len)) {
+        return (-1);
+    }
+
+    klog_flush();
+    console_write((const char *)sqe->addr, sqe->len);
+    return sqe->len;
+}
+
+static int32_t ring_op_read(const struct ring_sqe *sqe) {
+    if (__check_ptr_userspace((const void *)sqe->addr, sqe->len) || __check_ptr_write((const void *)sqe->addr, sqe->len)) {
+        return (-1);
+    }
+
+    return serial_read((char *)sqe->addr, sqe->len);
+}
+
+//recorded in the ring, removed with it at the latest
+static int32_t ring_op_mmap(struct ring *ring, const struct ring_sqe *sqe) {
+    void *hint = sqe->addr ? (void *)sqe->addr : RING_USER_HINT;
+    uint32_t slot;
+
+    if (sqe->len == 0) {
+        return (-1);
+    }
+
+    for (slot = 0; slot < RING_MAX_MAPPINGS && ring->mappings[slot] != (void *)0; slot++) {}
+    if (slot == RING_MAX_MAPPINGS) {
+        return (-1);
+    }
+
+    void *addr = add_vm_entry(hint, (sqe->len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), VM_MAP_ANONYMOUS | VM_MAP_USER | VM_MAP_WRITE, (void *)0, 0, 0);
+    if (addr == (void *)0) {
+        return (-1);
+    }
+
+    ring->mappings[slot] = addr;
+    return (int32_t)addr;
+}
+
+//what this ring's RING_OP_MMAP returned only: not the program, its stack
+//nor anything of another task, the address space is shared
+static int32_t ring_op_munmap(struct ring *ring, const struct ring_sqe *sqe) {
+    for (uint32_t slot = 0; slot < RING_MAX_MAPPINGS; slot++) {
+        if (ring->mappings[slot] != (void *)0 && ring->mappings[slot] == (void *)sqe->addr) {
+            rm_vm_entry(ring->mappings[slot]);
+            ring->mappings[slot] = (void *)0;
+            return (0);
+        }
+    }
+
+    return (-1);
+}
+
+static int32_t ring_execute(struct ring *ring, const struct ring_sqe *sqe) {
+    switch (sqe->opcode) {
+        case RING_OP_NOP:
+            return (0);
+        case RING_OP_WRITE:
+            return ring_op_write(sqe);
+        case RING_OP_READ:
+            return ring_op_read(sqe);
+        case RING_OP_MMAP:
+            return ring_op_mmap(ring, sqe);
+        case RING_OP_MUNMAP:
+            return ring_op_munmap(ring, sqe);
+    }
+
+    return (-1);
+}
+
+//consume up to max sqes, returns how many were
+static uint32_t ring_submit(struct ring *ring, uint32_t max) {
+    uint32_t tail = __atomic_load_n(&ring->header->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t pending = tail - ring->sq_head;
+    uint32_t done = 0;
+
+    if (pending > ring->sq_entries) {
+        return (0); //garbage tail
+    }
+
+    while (done < pending && done < max) {
+        //no room for the completion: leave the rest queued
+        uint32_t cq_head = __atomic_load_n(&ring->header->cq_head, __ATOMIC_ACQUIRE);
+        if (ring->cq_tail - cq_head >= ring->cq_entries) {
+            __atomic_fetch_add(&ring->header->cq_overflow, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        struct ring_sqe sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        ring->sq_head++;
+        __atomic_store_n(&ring->header->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+
+        struct ring_cqe *cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->res = ring_execute(ring, &sqe);
+        ring->cq_tail++;
+        __atomic_store_n(&ring->header->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+
+        done++;
+    }
+
+    return done;
+}
+
+int32_t ring_setup(uint32_t entries, uint32_t flags) {
+    struct task *task = current;
+
+    if (task->ring != (void *)0) {
+        return (-1); //one per task
+    }
+
+    if (entries == 0 || entries > RING_MAX_ENTRIES || (entries & (entries - 1)) != 0) {
+        return (-1);
+    }
+
+    uint32_t sq_offset = sizeof(struct ring_header);
+    uint32_t cq_offset = sq_offset + entries * sizeof(struct ring_sqe);
+    uint32_t size = cq_offset + 2 * entries * sizeof(struct ring_cqe);
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    struct ring *ring = malloc(sizeof(struct ring));
+    if (ring == (void *)0) {
+        return (-1);
+    }
+    memset(ring, 0, sizeof(struct ring));
+
+    void *base = add_vm_entry(RING_USER_HINT, size, VM_MAP_ANONYMOUS | VM_MAP_USER | VM_MAP_WRITE, (void *)0, 0, 0);
+    if (base == (void *)0) {
+        free(ring);
+        return (-1);
+    }
+
+    //fault it in now, the poller must not take page faults
+    memset(base, 0, size);
+
+    ring->header = base;
+    ring->sqes = base + sq_offset;
+    ring->cqes = base + cq_offset;
+    ring->sq_head = 0;
+    ring->cq_tail = 0;
+    ring->sq_entries = entries;
+    ring->cq_entries = 2 * entries;
+    ring->flags = flags & RING_SETUP_SQPOLL;
+
+    ring->header->sq_entries = ring->sq_entries;
+    ring->header->cq_entries = ring->cq_entries;
+    ring->header->sq_offset = sq_offset;
+    ring->header->cq_offset = cq_offset;
+    ring->header->flags = ring->flags;
+
+    task->ring = ring;
+    return (int32_t)base;
+}
+
+//task_exit: unmaps it, what it mapped, and frees it
+void ring_destroy(struct ring *ring) {
+    if (ring == (void *)0) {
+        return;
+    }
+
+    for (uint32_t slot = 0; slot < RING_MAX_MAPPINGS; slot++) {
+        if (ring->mappings[slot] != (void *)0) {
+            rm_vm_entry(ring->mappings[slot]);
+        }
+    }
+    rm_vm_entry(ring->header);
+    free(ring);
+}
+
+int32_t ring_enter(uint32_t to_submit, uint32_t min_complete __attribute__((unused))) {
+    struct ring *ring = current->ring;
+
+    if (ring == (void *)0) {
+        return (-1);
+    }
+
+    return ring_submit(ring, to_submit);
+}
+
+//called on the way back to userspace from an interrupt, for the task going back
+void ring_poll() {
+    struct ring *ring = current->ring;
+
+    if (ring == (void *)0 || (ring->flags & RING_SETUP_SQPOLL) == 0) {
+        return;
+    }
+
+    ring_submit(ring, ring->sq_entries);
+}
@@ -0,0 +1,55 @@
+#ifndef __RING__
+#define __RING__
+
+#include <stdint.h>
+
+// Submission/completion rings shared with userspace (userspace/ring.h has
+// the same layout). One mapping: header, then the sqes, then the cqes.
+// Each task has at most one, its operations run on that task's behalf.
+
+#define RING_OP_NOP 0
+#define RING_OP_WRITE 1 //console write of addr/len
+#define RING_OP_READ 2 //whatever the serial line received, up to len
+#define RING_OP_MMAP 3 //anonymous writable mapping of len bytes near addr
+#define RING_OP_MUNMAP 4
+
+#define RING_SETUP_SQPOLL 0x1 //the kernel drains the sq on its own
+
+#define RING_MAX_ENTRIES 256
+
+struct ring_header {
+    volatile uint32_t sq_head; //written by the kernel
+    volatile uint32_t sq_tail; //written by userspace
+    volatile uint32_t cq_head; //written by userspace
+    volatile uint32_t cq_tail; //written by the kernel
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_offset;
+    uint32_t cq_offset;
+    uint32_t flags;
+    volatile uint32_t cq_overflow;
+    uint32_t reserved[6];
+};
+
+struct ring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t user_data;
+};
+
+struct ring_cqe {
+    uint32_t user_data;
+    int32_t res;
+};
+
+struct ring;
+
+int32_t ring_setup(uint32_t entries, uint32_t flags);
+void ring_destroy(struct ring *ring);
+int32_t ring_enter(uint32_t to_submit, uint32_t min_complete);
+void ring_poll(void);
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include "rtc.h"
+#include "io.h"
+
+// CMOS real time clock, only read once at boot for the wall clock base.
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA 0x71
+
+#define RTC_SECONDS 0x00
+#define RTC_MINUTES 0x02
+#define RTC_HOURS 0x04
+#define RTC_DAY 0x07
+#define RTC_MONTH 0x08
+#define RTC_YEAR 0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+#define RTC_UPDATE_IN_PROGRESS 0x80
+#define RTC_24H 0x02
+#define RTC_BINARY 0x04
+#define RTC_PM 0x80
+
+struct rtc_time {
+    uint8_t second;
+    uint8_t minute;
+    uint8_t hour;
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;
+};
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS, reg);
+    return inb(CMOS_DATA);
+}
+
+static void rtc_read_raw(struct rtc_time *time) {
+    while (cmos_read(RTC_STATUS_A) & RTC_UPDATE_IN_PROGRESS) {}
+
+    time->second = cmos_read(RTC_SECONDS);
+    time->minute = cmos_read(RTC_MINUTES);
+    time->hour = cmos_read(RTC_HOURS);
+    time->day = cmos_read(RTC_DAY);
+    time->month = cmos_read(RTC_MONTH);
+    time->year = cmos_read(RTC_YEAR);
+}
+
+static uint8_t bcd_to_binary(uint8_t value) {
+    return (value & 0x0F) + (value >> 4) * 10;
+}
+
+//days since 1970-01-01 of a civil date (Howard Hinnant's algorithm)
+static uint32_t days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+uint32_t rtc_read_epoch() {
+    struct rtc_time time;
+    struct rtc_time check;
+
+    //read until two reads agree, the clock may tick in between
+    rtc_read_raw(&time);
+    do {
+        check = time;
+        rtc_read_raw(&time);
+    } while (check.second != time.second || check.minute != time.minute || check.hour != time.hour ||
+             check.day != time.day || check.month != time.month || check.year != time.year);
+
+    uint8_t status = cmos_read(RTC_STATUS_B);
+    uint8_t pm = time.hour & RTC_PM;
+    time.hour &= ~RTC_PM;
+
+    if ((status & RTC_BINARY) == 0) {
+        time.second = bcd_to_binary(time.second);
+        time.minute = bcd_to_binary(time.minute);
+        time.hour = bcd_to_binary(time.hour);
+        time.day = bcd_to_binary(time.day);
+        time.month = bcd_to_binary(time.month);
+        time.year = bcd_to_binary(time.year);
+    }
+
+    if ((status & RTC_24H) == 0) {
+        time.hour = time.hour % 12 + (pm ? 12 : 0);
+    }
+
+    uint32_t days = days_from_civil(2000 + time.year, time.month, time.day);
+    return days * 86400 + time.hour * 3600 + time.minute * 60 + time.second;
+}
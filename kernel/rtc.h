@@ -0,0 +1,8 @@
+#ifndef __RTC__
+#define __RTC__
+
+#include <stdint.h>
+
+uint32_t rtc_read_epoch(void);
+
+#endif
@@ -0,0 +1,343 @@
+#include <stdint.h>
+#include "task.h"
+#include "smp.h"
+#include "io.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "timer.h"
+#include "clocksource.h"
+#include "fpu.h"
+#include "lock.h"
+#include "rcu.h"
+#include "stdlib.h"
+
+// O(1) run queues, one per cpu: a fifo per priority and a bitmap of the
+// non empty ones, the next task is the head of the lowest set bit. The
+// running task is not in the queue. Tasks are preempted on their way back
+// to userspace only (interrupt and sysenter exits), once need_resched was
+// set by the time slice timer or by the wake up of a more important task.
+// A woken task goes back to the cpu it ran on (its fpu state may still be
+// in that cpu's registers), a cpu running out of work steals from the
+// busiest queue.
+
+extern void switch_context(uint32_t *prev_esp, uint32_t next_esp); //switch.asm
+extern void update_kernel_stack(void *stack); //tss.c
+extern void stack_space(void); //kernel.asm, the boot stack
+
+//runs from the timer softirq, on whichever cpu has it
+static void timeslice_fnc(void *ext) {
+    struct cpu *cpu = (struct cpu *)ext;
+    unsigned int flags = irq_save();
+
+    if (cpu->run_queue.count != 0 && cpu->curr != cpu->idle) {
+        cpu->need_resched = 1;
+        smp_send_ipi(cpu, IRQ_IPI_RESCHEDULE);
+    }
+
+    irq_restore(flags);
+}
+
+//no tick while a task has the cpu for itself; must be called with interrupts off
+static void sched_arm_timeslice(struct cpu *cpu) {
+    if (cpu->curr != cpu->idle && cpu->run_queue.count != 0 && !timer_pending(&cpu->timeslice)) {
+        timer_add(&cpu->timeslice, TASK_TIMESLICE_MS);
+    }
+}
+
+//must be called with interrupts off
+static void run_queue_push(struct run_queue *run_queue, struct task *task) {
+    uint8_t priority = task->priority;
+
+    task->state = TASK_READY;
+    task->next = (void *)0;
+    if (run_queue->tail[priority] != (void *)0) {
+        run_queue->tail[priority]->next = task;
+    } else {
+        run_queue->head[priority] = task;
+    }
+    run_queue->tail[priority] = task;
+    run_queue->bitmap |= 1 << priority;
+    run_queue->count++;
+}
+
+//must be called with interrupts off
+static void run_queue_unlink(struct run_queue *run_queue, struct task *task, struct task *prev) {
+    uint8_t priority = task->priority;
+
+    if (prev != (void *)0) {
+        prev->next = task->next;
+    } else {
+        run_queue->head[priority] = task->next;
+    }
+    if (run_queue->tail[priority] == task) {
+        run_queue->tail[priority] = prev;
+    }
+    if (run_queue->head[priority] == (void *)0) {
+        run_queue->bitmap &= ~(1 << priority);
+    }
+    run_queue->count--;
+    task->next = (void *)0;
+}
+
+//must be called with interrupts off
+static struct task *run_queue_pop(struct run_queue *run_queue) {
+    if (run_queue->bitmap == 0) {
+        return (void *)0;
+    }
+
+    struct task *task = run_queue->head[__builtin_ctz(run_queue->bitmap)];
+    run_queue_unlink(run_queue, task, (void *)0);
+
+    return task;
+}
+
+//least loaded online cpu, for new tasks
+static struct cpu *sched_select_cpu(void) {
+    struct cpu *best = this_cpu();
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = &cpus[i];
+        uint32_t load = cpu->run_queue.count + (cpu->curr != cpu->idle);
+        uint32_t best_load = best->run_queue.count + (best->curr != best->idle);
+
+        if (cpu->online && load < best_load) {
+            best = cpu;
+        }
+    }
+
+    return best;
+}
+
+//takes the least important waiting task of the busiest cpu, skipping the
+//ones whose fpu registers are still live over there. interrupts off
+static struct task *sched_steal(struct cpu *self) {
+    struct cpu *busiest = (void *)0;
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = &cpus[i];
+        if (cpu != self && cpu->online && cpu->run_queue.count != 0 &&
+            (busiest == (void *)0 || cpu->run_queue.count > busiest->run_queue.count)) {
+            busiest = cpu;
+        }
+    }
+
+    if (busiest == (void *)0) {
+        return (void *)0;
+    }
+
+    for (int priority = TASK_PRIORITIES - 1; priority >= 0; priority--) {
+        struct task *prev = (void *)0;
+
+        for (struct task *task = busiest->run_queue.head[priority]; task != (void *)0; prev = task, task = task->next) {
+            if (busiest->fpu_owner == &task->fpu) {
+                continue;
+            }
+
+            run_queue_unlink(&busiest->run_queue, task, prev);
+            self->steals++;
+            return task;
+        }
+    }
+
+    return (void *)0;
+}
+
+//a task waits on a busy cpu: wake an idle one, it will steal it
+static void sched_kick_idle(struct cpu *busy) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = &cpus[i];
+
+        if (cpu != busy && cpu->online && cpu->curr == cpu->idle && !cpu->need_resched) {
+            cpu->need_resched = 1;
+            smp_send_ipi(cpu, IRQ_IPI_RESCHEDULE);
+            return;
+        }
+    }
+}
+
+void sched_enqueue(struct task *task) {
+    unsigned int flags = irq_save();
+    struct cpu *cpu;
+
+    if (task->state == TASK_BLOCKED && task->switches == 0) {
+        cpu = sched_select_cpu(); //new one, nothing keeps it anywhere
+        task->cpu = cpu->index;
+    } else {
+        cpu = &cpus[task->cpu];
+    }
+
+    run_queue_push(&cpu->run_queue, task);
+    if (cpu->curr == cpu->idle || task->priority < cpu->curr->priority) {
+        cpu->need_resched = 1;
+        smp_send_ipi(cpu, IRQ_IPI_RESCHEDULE);
+    } else {
+        sched_kick_idle(cpu);
+    }
+    sched_arm_timeslice(cpu);
+
+    irq_restore(flags);
+}
+
+void schedule() {
+    unsigned int flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    struct task *prev = cpu->curr;
+
+    //no rcu reader sleeps, a switch is a quiescent state
+    rcu_note_qs();
+
+    if (prev->state == TASK_RUNNING && prev != cpu->idle) {
+        run_queue_push(&cpu->run_queue, prev);
+    }
+
+    struct task *next = run_queue_pop(&cpu->run_queue);
+    if (next == (void *)0) {
+        next = sched_steal(cpu);
+    }
+    if (next == (void *)0) {
+        next = cpu->idle;
+    }
+
+    cpu->need_resched = 0;
+    next->state = TASK_RUNNING;
+    next->cpu = cpu->index;
+
+    if (next != prev) {
+        uint64_t now = ktime_get_ns();
+
+        prev->runtime_ns += now - prev->switched_in_ns;
+        next->switched_in_ns = now;
+        next->switches++;
+
+        //a task can be switched out from inside an exception (a page fault
+        //waiting on the disk), the nesting count goes with it; so does the
+        //kernel lock depth, the lock itself stays with the cpu
+        prev->nesting = cpu->interrupt_nesting;
+        cpu->interrupt_nesting = next->nesting;
+        prev->lock_depth = cpu->lock_depth;
+        cpu->lock_depth = next->lock_depth;
+
+        cpu->curr = next;
+        update_kernel_stack(next->kstack != (void *)0 ? (uint8_t *)next->kstack + TASK_KSTACK_SIZE : (void *)stack_space);
+        fpu_switch(&next->fpu);
+        sched_arm_timeslice(cpu);
+
+        switch_context(&prev->esp, next->esp);
+    }
+
+    irq_restore(flags);
+}
+
+void sched_yield() {
+    schedule();
+}
+
+//on the way back to userspace, with interrupts off. Nothing of the kernel
+//is in use past this point, a quiescent state for rcu
+void sched_preempt() {
+    rcu_note_qs();
+    if (this_cpu_read(need_resched)) {
+        schedule();
+    }
+}
+
+//tasks may sleep, not interrupt handlers, work items or the idle tasks
+int sched_can_block() {
+    return current != (void *)0 && current != idle_task && this_cpu_read(irq_handler_depth) == 0 && !softirq_active();
+}
+
+void sched_init_cpu(uint32_t index) {
+    struct cpu *cpu = &cpus[index];
+
+    memset(&cpu->run_queue, 0, sizeof(struct run_queue));
+    cpu->need_resched = 0;
+    cpu->timeslice.next = (void *)0;
+    cpu->timeslice.pprev = (void *)0;
+    cpu->timeslice.fnc = timeslice_fnc;
+    cpu->timeslice.ext = cpu;
+}
+
+//must be called with interrupts off
+static void wait_queue_add(struct wait_queue *queue) {
+    struct task *task = current;
+
+    task->state = TASK_BLOCKED;
+    task->next = (void *)0;
+    if (queue->tail != (void *)0) {
+        queue->tail->next = task;
+    } else {
+        queue->head = task;
+    }
+    queue->tail = task;
+}
+
+//must be called with interrupts off, the caller checks its condition again after
+void wait_queue_sleep(struct wait_queue *queue) {
+    wait_queue_add(queue);
+    schedule();
+}
+
+//same, for a condition guarded by lock: it is dropped once the task is on
+//the queue, a waker holding it can't be missed. Returns without the lock
+void wait_queue_sleep_unlock(struct wait_queue *queue, struct spinlock *lock) {
+    wait_queue_add(queue);
+    spin_unlock(lock);
+    schedule();
+}
+
+void wait_queue_wake(struct wait_queue *queue) {
+    unsigned int flags = irq_save();
+    struct task *task = queue->head;
+
+    queue->head = (void *)0;
+    queue->tail = (void *)0;
+
+    while (task != (void *)0) {
+        struct task *next = task->next;
+        sched_enqueue(task);
+        task = next;
+    }
+
+    irq_restore(flags);
+}
+
+//what each cpu's boot context turns into, with the kernel lock held
+void sched_idle() {
+    struct cpu *cpu = this_cpu();
+
+    for (;;) {
+        asm volatile("cli" ::: "memory");
+
+        rcu_note_qs();
+        task_reap_orphans();
+        softirq_run(); //what the interrupt exits left over
+
+        //schedule() steals when there is nothing here
+        if (cpu->need_resched || cpu->run_queue.count != 0) {
+            schedule();
+            continue;
+        }
+
+        if (softirq_pending()) {
+            continue;
+        }
+
+        cpu_idle_halt();
+    }
+}
+
+void sched_dump() {
+    kprintf("\n=== RUN QUEUES ===\n");
+    kprintf("cpu apic online current queued ipis tlb_flushes steals\n");
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = &cpus[i];
+
+        if (!cpu->online) {
+            continue;
+        }
+
+        kprintf("%2d %3d %1d %3d %3d %8d %8d %8d\n", cpu->index, cpu->apic_id, cpu->online, cpu->curr->pid,
+                cpu->run_queue.count, cpu->ipis, cpu->tlb_flushes, cpu->steals);
+    }
+}
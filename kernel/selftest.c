@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include "selftest.h"
+#include "liballoc.h"
+#include "stdlib.h"
+#include "klog.h"
+
+static uint32_t selftest_checks = 0;
+static uint32_t selftest_failures = 0;
+
+void selftest_check(const char *name, int ok) {
+    selftest_checks++;
+    if (!ok) {
+        selftest_failures++;
+        klog_error("selftest: %s failed\n", name);
+    }
+}
+
+//bigger than any free block at boot: each one has to grow the heap, like
+//on an empty one, and the new pool has to be found by the search
+static void heap_selftest(void) {
+    static const uint32_t sizes[] = { 65000, 100000, 300000, 1024 * 1024 + 8 };
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t *ptr = malloc(sizes[i]);
+
+        selftest_check("heap: large allocation", ptr != (void *)0);
+        if (ptr != (void *)0) {
+            memset(ptr, 0xA5, sizes[i]);
+            selftest_check("heap: large allocation usable", ptr[0] == 0xA5 && ptr[sizes[i] - 1] == 0xA5);
+            free(ptr);
+        }
+    }
+}
+
+//after timer_init, before the first task
+void selftest_run() {
+    heap_selftest();
+    timer_selftest();
+
+    klog_info("selftest: %d checks, %d failed\n", selftest_checks, selftest_failures);
+}
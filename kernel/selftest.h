@@ -0,0 +1,14 @@
+#ifndef __SELFTEST__
+#define __SELFTEST__
+
+#include <stdint.h>
+
+// Boot time checks of paths that are hard to reach by hand, built with
+// SELFTEST=1. Results go to the kernel log.
+
+void selftest_check(const char *name, int ok);
+void selftest_run(void);
+
+void timer_selftest(void); //timer.c
+
+#endif
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include "serial.h"
+#include "io.h"
+#include "interrupt.h"
+#include "stdlib.h"
+#include "softirq.h"
+
+// 16550 uart driver for COM1. Writers only copy into the tx ring, the
+// "transmitter holding register empty" interrupt feeds the fifo from it.
+// Received bytes go to the rx ring until someone reads them.
+
+#define SERIAL_DATA 0 //dlab=0
+#define SERIAL_IER 1 //dlab=0
+#define SERIAL_DLL 0 //dlab=1
+#define SERIAL_DLM 1 //dlab=1
+#define SERIAL_IIR 2 //read
+#define SERIAL_FCR 2 //write
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_SCR 7
+
+#define IER_RX_AVAILABLE 0x01
+#define IER_TX_EMPTY 0x02
+
+#define IIR_NO_INTERRUPT 0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_TX_EMPTY 0x02
+#define IIR_RX_AVAILABLE 0x04
+#define IIR_LINE_STATUS 0x06
+#define IIR_RX_TIMEOUT 0x0C
+
+#define FCR_ENABLE 0x01
+#define FCR_CLEAR_RX 0x02
+#define FCR_CLEAR_TX 0x04
+#define FCR_TRIGGER_14 0xC0
+
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+
+#define MCR_DTR 0x01
+#define MCR_RTS 0x02
+#define MCR_OUT2 0x08 //gates the irq line on pc hardware
+#define MCR_LOOPBACK 0x10
+
+#define LSR_DATA_READY 0x01
+#define LSR_THR_EMPTY 0x20
+
+#define SERIAL_CLOCK 115200
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_INTERRUPT 0x24 //irq 4
+
+//power of 2 so the free running indexes wrap cleanly
+#define SERIAL_TX_SIZE 4096
+#define SERIAL_RX_SIZE 256
+
+struct serial_ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+};
+
+static char tx_buffer[SERIAL_TX_SIZE];
+static char rx_buffer[SERIAL_RX_SIZE];
+static struct serial_ring tx;
+static struct serial_ring rx;
+static uint8_t serial_ok = 0;
+static uint8_t tx_active = 0;
+static struct work_item *rx_work = (void *)0;
+
+uint32_t serial_tx_overruns = 0;
+uint32_t serial_rx_dropped = 0;
+
+static inline uint8_t serial_in(uint16_t reg) {
+    return inb(SERIAL_COM1 + reg);
+}
+
+static inline void serial_out(uint16_t reg, uint8_t value) {
+    outb(SERIAL_COM1 + reg, value);
+}
+
+//must be called with interrupts off
+static void serial_fill_fifo(void) {
+    uint32_t count = 0;
+
+    while (tx.tail != tx.head && count < SERIAL_FIFO_SIZE) {
+        serial_out(SERIAL_DATA, tx_buffer[tx.tail % SERIAL_TX_SIZE]);
+        tx.tail++;
+        count++;
+    }
+
+    //keep the tx interrupt only while there is something to send
+    if (tx.tail != tx.head) {
+        if (!tx_active) {
+            serial_out(SERIAL_IER, IER_RX_AVAILABLE | IER_TX_EMPTY);
+            tx_active = 1;
+        }
+    } else if (tx_active) {
+        serial_out(SERIAL_IER, IER_RX_AVAILABLE);
+        tx_active = 0;
+    }
+}
+
+static int serial_interrupt_handler(unsigned int interrupt __attribute__((unused)), void *ext __attribute__((unused))) {
+    int handled = IRQ_NONE;
+    uint8_t iir;
+
+    while (((iir = serial_in(SERIAL_IIR)) & IIR_NO_INTERRUPT) == 0) {
+        handled = IRQ_HANDLED;
+        switch (iir & IIR_ID_MASK) {
+            case IIR_RX_AVAILABLE:
+            case IIR_RX_TIMEOUT:
+                while (serial_in(SERIAL_LSR) & LSR_DATA_READY) {
+                    char c = serial_in(SERIAL_DATA);
+                    if (rx.head - rx.tail < SERIAL_RX_SIZE) {
+                        rx_buffer[rx.head % SERIAL_RX_SIZE] = c;
+                        rx.head++;
+                    } else {
+                        serial_rx_dropped++;
+                    }
+                }
+                if (rx_work != (void *)0) {
+                    softirq_raise(SOFTIRQ_HI, rx_work);
+                }
+                break;
+
+            case IIR_TX_EMPTY:
+                serial_fill_fifo();
+                break;
+
+            case IIR_LINE_STATUS:
+                serial_in(SERIAL_LSR);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return handled;
+}
+
+int serial_init(uint32_t baud) {
+    uint16_t divisor = SERIAL_CLOCK / baud;
+
+    if (divisor == 0) {
+        divisor = 1;
+    }
+
+    //no uart if the scratch register doesn't hold a value
+    serial_out(SERIAL_SCR, 0x5A);
+    if (serial_in(SERIAL_SCR) != 0x5A) {
+        return (1);
+    }
+
+    serial_out(SERIAL_IER, 0);
+    serial_out(SERIAL_LCR, LCR_DLAB);
+    serial_out(SERIAL_DLL, divisor & 0xFF);
+    serial_out(SERIAL_DLM, divisor >> 8);
+    serial_out(SERIAL_LCR, LCR_8N1);
+    serial_out(SERIAL_FCR, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_14);
+
+    //loopback self test
+    serial_out(SERIAL_MCR, MCR_LOOPBACK | MCR_RTS | MCR_OUT2);
+    serial_out(SERIAL_DATA, 0xAE);
+    if (serial_in(SERIAL_DATA) != 0xAE) {
+        return (2);
+    }
+
+    serial_out(SERIAL_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+
+    memset(&tx, 0, sizeof(tx));
+    memset(&rx, 0, sizeof(rx));
+    tx_active = 0;
+    serial_ok = 1;
+
+    register_interrupt(SERIAL_INTERRUPT, serial_interrupt_handler, 0);
+    serial_out(SERIAL_IER, IER_RX_AVAILABLE);
+
+    return (0);
+}
+
+int serial_present() {
+    return serial_ok;
+}
+
+//must be called with interrupts off
+static void serial_push(char c) {
+    if (tx.head - tx.tail >= SERIAL_TX_SIZE) {
+        //only when the ring overflows (or interrupts are off for long): wait the fifo out
+        serial_tx_overruns++;
+        while (tx.head - tx.tail >= SERIAL_TX_SIZE) {
+            while ((serial_in(SERIAL_LSR) & LSR_THR_EMPTY) == 0) {}
+            serial_fill_fifo();
+        }
+    }
+
+    tx_buffer[tx.head % SERIAL_TX_SIZE] = c;
+    tx.head++;
+}
+
+void serial_write(const char *buffer, uint32_t size) {
+    if (!serial_ok) {
+        return;
+    }
+
+    unsigned int flags = irq_save();
+
+    for (uint32_t i = 0; i < size; i++) {
+        if (buffer[i] == '\n') {
+            serial_push('\r');
+        }
+        serial_push(buffer[i]);
+    }
+
+    //start the transmitter if it is idle, the interrupt takes it from there
+    if (!tx_active && (serial_in(SERIAL_LSR) & LSR_THR_EMPTY)) {
+        serial_fill_fifo();
+    }
+
+    irq_restore(flags);
+}
+
+//work raised (on the hi softirq) each time bytes come in
+void serial_rx_notify(struct work_item *work) {
+    rx_work = work;
+}
+
+uint32_t serial_read(char *buffer, uint32_t size) {
+    uint32_t count = 0;
+    unsigned int flags = irq_save();
+
+    while (count < size && rx.tail != rx.head) {
+        buffer[count++] = rx_buffer[rx.tail % SERIAL_RX_SIZE];
+        rx.tail++;
+    }
+
+    irq_restore(flags);
+    return count;
+}
@@ -0,0 +1,20 @@
+#ifndef __SERIAL__
+#define __SERIAL__
+
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 115200
+#endif
+
+int serial_init(uint32_t baud);
+void serial_write(const char *buffer, uint32_t size);
+uint32_t serial_read(char *buffer, uint32_t size);
+int serial_present(void);
+
+struct work_item;
+void serial_rx_notify(struct work_item *work);
+
+#endif
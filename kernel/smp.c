@@ -0,0 +1,276 @@
+#include <stdint.h>
+#include "smp.h"
+#include "apic.h"
+#include "acpi.h"
+#include "interrupt.h"
+#include "vmm.h"
+#include "pit.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "vdso.h"
+#include "klog.h"
+#include "io.h"
+#include "lock.h"
+#include "liballoc.h"
+#include "stdlib.h"
+
+// Startup is the usual INIT, SIPI, SIPI: the trampoline (trampoline.asm)
+// gets the processor from real mode to paging on the kernel page directory
+// and calls smp_ap_entry on its idle task's stack. The trampoline page is
+// identity mapped for the time of the startup only.
+
+#define SMP_STARTUP_WAIT_MS 100
+#define SMP_TLB_FULL_FLUSH 32 //pages, a cr3 reload is cheaper past that
+
+//trampoline.asm, copied to SMP_TRAMPOLINE_ADDR
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint32_t smp_trampoline_cr3;
+extern uint32_t smp_trampoline_stack;
+extern uint32_t smp_trampoline_cpu;
+
+#define TRAMPOLINE_VAR(var) (*(volatile uint32_t *)(SMP_TRAMPOLINE_ADDR + ((uint8_t *)&(var) - smp_trampoline_start)))
+
+extern void gdt_setup_cpu(uint32_t cpu); //gdt.c
+extern void tss_setup_cpu(uint32_t cpu, uint32_t esp0); //tss.c
+extern void idt_load(void); //interrupt.c
+
+//the boot processor holds the kernel lock from the start
+struct cpu cpus[SMP_MAX_CPUS] = {
+    [0] = { .self = &cpus[0], .index = 0, .online = 1, .lock_depth = 1 },
+};
+uint32_t smp_cpu_count = 1;
+uint8_t smp_started = 0;
+
+//the boot processor's ticket is the first one
+static struct spinlock kernel_spinlock = { .owner = 0, .next = 1, LOCK_STAT_INIT("kernel") };
+static volatile uint32_t kernel_lock_owner = 0;
+
+static volatile virtaddr_t tlb_start;
+static volatile uint32_t tlb_pages;
+
+static void smp_tlb_flush_local(virtaddr_t start, uint32_t pages) {
+    if (pages > SMP_TLB_FULL_FLUSH) {
+        write_cr3(read_cr3());
+        return;
+    }
+
+    for (uint32_t i = 0; i < pages; i++) {
+        flush_tlb_single(start + i * PAGE_SIZE);
+    }
+}
+
+static void smp_tlb_poll(struct cpu *cpu) {
+    if (cpu->tlb_flush) {
+        smp_tlb_flush_local(tlb_start, tlb_pages);
+        cpu->tlb_flushes++;
+        __atomic_store_n(&cpu->tlb_flush, 0, __ATOMIC_RELEASE);
+    }
+}
+
+//spin loop body: the lock holder may be waiting on a tlb shootdown
+void smp_cpu_relax() {
+    smp_tlb_poll(this_cpu());
+    asm volatile("pause" ::: "memory");
+}
+
+//interrupts off
+void kernel_lock() {
+    struct cpu *cpu = this_cpu();
+
+    if (kernel_lock_owner == cpu->index) {
+        cpu->lock_depth++;
+        return;
+    }
+
+    spin_lock(&kernel_spinlock);
+    kernel_lock_owner = cpu->index;
+    cpu->lock_depth = 1;
+}
+
+//interrupts off
+void kernel_unlock() {
+    struct cpu *cpu = this_cpu();
+
+    if (--cpu->lock_depth == 0) {
+        kernel_lock_owner = SMP_NO_CPU;
+        spin_unlock(&kernel_spinlock);
+    }
+}
+
+//hlt without the kernel lock, the other cpus go on meanwhile. interrupts
+//off on entry and return
+void cpu_idle_halt() {
+    struct cpu *cpu = this_cpu();
+    uint32_t depth = cpu->lock_depth;
+
+    if (depth == 0) {
+        asm volatile("sti\n"
+                     "hlt\n"
+                     "cli" ::: "memory");
+        return;
+    }
+
+    cpu->lock_depth = 0;
+    kernel_lock_owner = SMP_NO_CPU;
+    spin_unlock(&kernel_spinlock);
+
+    asm volatile("sti\n"
+                 "hlt\n"
+                 "cli" ::: "memory");
+
+    kernel_lock();
+    cpu->lock_depth = depth;
+}
+
+void smp_send_ipi(struct cpu *cpu, uint8_t vector) {
+    if (smp_started && cpu->online && cpu != this_cpu()) {
+        lapic_send_ipi(cpu->apic_id, vector);
+    }
+}
+
+//the caller changed the page tables and holds the kernel lock, so there
+//is one shootdown at a time. waits for every other cpu to have flushed
+void smp_tlb_shootdown(virtaddr_t start, uint32_t pages) {
+    struct cpu *self = this_cpu();
+
+    if (!smp_started) {
+        return;
+    }
+
+    tlb_start = start;
+    tlb_pages = pages;
+    __sync_synchronize();
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (&cpus[i] != self && cpus[i].online) {
+            cpus[i].tlb_flush = 1;
+            smp_send_ipi(&cpus[i], IRQ_IPI_TLB);
+        }
+    }
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        while (__atomic_load_n(&cpus[i].tlb_flush, __ATOMIC_ACQUIRE)) {
+            asm volatile("pause" ::: "memory");
+        }
+    }
+}
+
+//straight from the interrupt stub, without the kernel lock
+void smp_tlb_interrupt() {
+    struct cpu *cpu = this_cpu();
+
+    cpu->ipis++;
+    smp_tlb_poll(cpu);
+    lapic_eoi();
+}
+
+//nothing to do, the interrupt exit looks at need_resched
+static int smp_reschedule_interrupt(unsigned int intno __attribute__((unused)), void *ext __attribute__((unused))) {
+    this_cpu_inc(ipis);
+    return (IRQ_HANDLED);
+}
+
+void smp_ap_entry(uint32_t index) __attribute__((noreturn));
+void smp_ap_entry(uint32_t index) {
+    struct cpu *cpu = &cpus[index];
+
+    gdt_setup_cpu(index); //this_cpu() works from here
+    tss_setup_cpu(index, (uint32_t)cpu->idle->kstack + SMP_STACK_SIZE);
+    idt_load();
+    cpu_init_ap();
+    fpu_init_cpu();
+    lapic_setup();
+
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+    kernel_lock();
+    fpu_switch(&cpu->idle->fpu);
+    klog_info("smp: cpu %d (apic %d) online\n", index, cpu->apic_id);
+
+    sched_idle();
+}
+
+static int smp_start_ap(struct cpu *cpu) {
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    pit_delay(10);
+
+    for (uint32_t sipi = 0; sipi < 2 && !cpu->online; sipi++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        for (uint32_t ms = 0; ms < SMP_STARTUP_WAIT_MS && !__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE); ms++) {
+            pit_delay(1);
+        }
+    }
+
+    return cpu->online ? 0 : 1;
+}
+
+//after task_init, with the apics up
+void smp_init() {
+    struct cpu *bsp = &cpus[0];
+    uint32_t next = 1;
+    uint8_t late = 0;
+
+    if (!apic_enabled || acpi_madt.cpu_count <= 1) {
+        return;
+    }
+
+    bsp->apic_id = lapic_id();
+    register_interrupt(IRQ_IPI_RESCHEDULE, smp_reschedule_interrupt, (void *)0);
+
+    if (map_page(SMP_TRAMPOLINE_ADDR, SMP_TRAMPOLINE_ADDR, VM_PAGE_READ_WRITE) != 0) {
+        klog_error("smp: unable to map the trampoline\n");
+        return;
+    }
+    memcpy((void *)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    TRAMPOLINE_VAR(smp_trampoline_cr3) = read_cr3();
+
+    smp_started = 1;
+
+    for (uint32_t i = 0; i < acpi_madt.cpu_count && next < SMP_MAX_CPUS; i++) {
+        uint8_t apic_id = acpi_madt.cpu_apic_ids[i];
+        struct cpu *cpu = &cpus[next];
+
+        if (apic_id == bsp->apic_id) {
+            continue;
+        }
+
+        //pre faulted: the ap takes its first interrupts on it
+        void *stack = malloc(SMP_STACK_SIZE);
+        if (stack == (void *)0) {
+            break;
+        }
+        memset(stack, 0, SMP_STACK_SIZE);
+
+        cpu->index = next;
+        cpu->apic_id = apic_id;
+        cpu->idle = cpu->curr = task_idle_create(next, stack);
+        if (cpu->idle == (void *)0) {
+            free(stack);
+            break;
+        }
+        sched_init_cpu(next);
+
+        TRAMPOLINE_VAR(smp_trampoline_stack) = (uint32_t)stack + SMP_STACK_SIZE;
+        TRAMPOLINE_VAR(smp_trampoline_cpu) = next;
+        __sync_synchronize();
+
+        if (smp_start_ap(cpu) != 0) {
+            klog_warn("smp: cpu with apic id %d doesn't answer\n", apic_id);
+            late = 1;
+        } else {
+            smp_cpu_count++;
+        }
+
+        //a late one may still come up on its slot, don't reuse it
+        next++;
+    }
+
+    //nor pull the trampoline from under it
+    if (!late) {
+        unmap_page(SMP_TRAMPOLINE_ADDR);
+    }
+    vdso_data->cpu_count = smp_cpu_count;
+
+    kprintf("smp: %d cpu online\n", smp_cpu_count);
+}
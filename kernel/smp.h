@@ -0,0 +1,96 @@
+#ifndef __SMP__
+#define __SMP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "acpi.h"
+#include "apic.h"
+#include "task.h"
+#include "timer.h"
+#include "fpu.h"
+#include "pmm.h"
+
+// Application processors are started through a real mode trampoline copied
+// at SMP_TRAMPOLINE_ADDR. Kernel code is serialized by one kernel lock,
+// taken on every entry (interrupt, sysenter, idle loop) and dropped on the
+// way back to userspace or to hlt: userspace runs in parallel, the kernel
+// doesn't (yet). Each cpu schedules its own run queue, idle ones steal
+// from the busiest.
+
+#define SMP_MAX_CPUS ACPI_MAX_CPUS
+#define SMP_NO_CPU 0xFFFFFFFF
+#define SMP_TRAMPOLINE_ADDR 0x8000 //low memory, reserved at boot
+#define SMP_STACK_SIZE TASK_KSTACK_SIZE
+#define SMP_PERCPU_SEL 0x30 //GDT_PERCPU (gdt.c), same on every cpu
+
+//the first two fields are at fixed offsets, sysenter.asm uses them
+struct cpu {
+    struct cpu *self;
+    uint32_t interrupt_nesting; //how deep in interrupt handlers, deferred work is run by the outermost one
+    uint32_t irq_handler_depth; //device handlers running, exceptions (page faults) may sleep, those may not
+    uint32_t index;
+    uint8_t apic_id;
+    volatile uint8_t online;
+
+    struct task *curr;
+    struct task *idle;
+    struct run_queue run_queue;
+    volatile uint8_t need_resched;
+    struct timer timeslice;
+
+    struct fpu_state *fpu_current; //state of the task running here
+    struct fpu_state *fpu_owner; //state living in this cpu's registers
+    uint8_t fpu_kernel_active;
+
+    uint32_t lock_depth; //kernel lock, when this cpu holds it
+    volatile uint8_t tlb_flush; //a shootdown is waiting for this cpu
+    volatile uint8_t rcu_qs_pending; //the grace period waits for this cpu (rcu.c)
+
+    uint32_t ipis;
+    uint32_t tlb_flushes;
+    uint32_t steals;
+};
+
+extern struct cpu cpus[SMP_MAX_CPUS];
+extern uint32_t smp_cpu_count; //online ones
+extern uint8_t smp_started;
+
+//1, 2 or 4 bytes fields of this cpu's struct cpu. Interrupts should be off
+//(or the value not care), a task may be moved to another cpu in between
+#define this_cpu_read(field) ({ \
+    __typeof__(((struct cpu *)0)->field) __val; \
+    asm volatile("mov %%gs:%c1, %0" : "=q"(__val) : "i"(offsetof(struct cpu, field))); \
+    __val; \
+})
+
+#define this_cpu_write(field, value) do { \
+    __typeof__(((struct cpu *)0)->field) __val = (value); \
+    asm volatile("mov %0, %%gs:%c1" :: "q"(__val), "i"(offsetof(struct cpu, field)) : "memory"); \
+} while (0)
+
+#define this_cpu_add(field, value) do { \
+    __typeof__(((struct cpu *)0)->field) __val = (value); \
+    asm volatile("add %0, %%gs:%c1" :: "q"(__val), "i"(offsetof(struct cpu, field)) : "memory", "cc"); \
+} while (0)
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+#define this_cpu_dec(field) this_cpu_add(field, -1)
+
+static inline struct cpu *this_cpu(void) {
+    return this_cpu_read(self);
+}
+
+#define current this_cpu_read(curr)
+#define idle_task this_cpu_read(idle)
+
+void smp_init(void);
+void smp_send_ipi(struct cpu *cpu, uint8_t vector);
+void smp_tlb_shootdown(virtaddr_t start, uint32_t pages);
+void smp_tlb_interrupt(void);
+void smp_cpu_relax(void);
+
+void kernel_lock(void);
+void kernel_unlock(void);
+void cpu_idle_halt(void);
+
+#endif
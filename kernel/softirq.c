@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include "softirq.h"
+#include "io.h"
+#include "cpu.h"
+#include "stdlib.h"
+
+// Queues are run in order, each up to its budget of items per pass; what
+// is left waits for the next interrupt exit (or the idle loop), so one
+// busy queue can't hold the others or the interrupted code for long.
+
+struct softirq {
+    struct work_item *head;
+    struct work_item *tail;
+    uint32_t budget;
+    const char *name;
+
+    uint32_t raised;
+    uint32_t runs;
+    uint32_t over_budget; //passes that stopped with items left
+    uint32_t max_cycles;
+    uint64_t cycles;
+};
+
+static struct softirq softirqs[SOFTIRQ_QUEUES] = {
+    [SOFTIRQ_HI] = { .budget = 16, .name = "hi" },
+    [SOFTIRQ_TIMER] = { .budget = 32, .name = "timer" },
+    [SOFTIRQ_BLOCK] = { .budget = 8, .name = "block" },
+    [SOFTIRQ_RCU] = { .budget = 1, .name = "rcu" }, //one item, it takes the whole batch
+    [SOFTIRQ_LOG] = { .budget = 1, .name = "log" },
+};
+
+static volatile uint32_t softirq_mask = 0; //queues with items
+static uint8_t softirq_running = 0;
+
+//callable from interrupt handlers; a pending item is not queued twice
+void softirq_raise(enum softirq_queue queue, struct work_item *work) {
+    struct softirq *softirq = &softirqs[queue];
+    unsigned int flags = irq_save();
+
+    if (!work->pending) {
+        work->pending = 1;
+        work->next = (void *)0;
+        if (softirq->tail) {
+            softirq->tail->next = work;
+        } else {
+            softirq->head = work;
+        }
+        softirq->tail = work;
+        softirq->raised++;
+        softirq_mask |= 1 << queue;
+    }
+
+    irq_restore(flags);
+}
+
+int softirq_pending() {
+    return softirq_mask != 0;
+}
+
+//true from inside a work item
+int softirq_active() {
+    return softirq_running;
+}
+
+static struct work_item *softirq_pop(struct softirq *softirq, uint32_t queue) {
+    struct work_item *work = softirq->head;
+
+    if (work != (void *)0) {
+        softirq->head = work->next;
+        if (softirq->head == (void *)0) {
+            softirq->tail = (void *)0;
+            softirq_mask &= ~(1 << queue);
+        }
+        work->pending = 0; //it can be raised again while it runs
+    }
+
+    return work;
+}
+
+//called with interrupts disabled, returns with interrupts disabled
+void softirq_run() {
+    if (softirq_running || softirq_mask == 0) {
+        return;
+    }
+    softirq_running = 1;
+
+    for (uint32_t queue = 0; queue < SOFTIRQ_QUEUES; queue++) {
+        struct softirq *softirq = &softirqs[queue];
+        uint32_t done;
+
+        for (done = 0; done < softirq->budget; done++) {
+            struct work_item *work = softirq_pop(softirq, queue);
+            if (work == (void *)0) {
+                break;
+            }
+
+            uint64_t start = cpu_has(CPU_FEATURE_TSC) ? rdtsc() : 0;
+            asm volatile("sti" ::: "memory");
+            work->fnc(work->ext);
+            asm volatile("cli" ::: "memory");
+
+            if (start != 0) {
+                uint64_t cycles = rdtsc() - start;
+                softirq->cycles += cycles;
+                if (cycles > softirq->max_cycles) {
+                    softirq->max_cycles = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : cycles;
+                }
+            }
+            softirq->runs++;
+        }
+
+        if (done == softirq->budget && softirq->head != (void *)0) {
+            softirq->over_budget++;
+        }
+    }
+
+    softirq_running = 0;
+}
+
+void softirq_dump() {
+    kprintf("\n=== SOFTIRQ ===\n");
+    kprintf("queue budget raised runs over_budget max_cycles cycles\n");
+
+    for (uint32_t queue = 0; queue < SOFTIRQ_QUEUES; queue++) {
+        struct softirq *softirq = &softirqs[queue];
+        kprintf("%s %1d %8d %8d %8d %8d 0x%h%8h\n", softirq->name, softirq->budget, softirq->raised, softirq->runs,
+                softirq->over_budget, softirq->max_cycles, (uint32_t)(softirq->cycles >> 32), (uint32_t)softirq->cycles);
+    }
+}
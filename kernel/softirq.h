@@ -0,0 +1,33 @@
+#ifndef __SOFTIRQ__
+#define __SOFTIRQ__
+
+#include <stdint.h>
+
+// Deferred interrupt work: handlers only acknowledge their device and
+// queue a work item, items run later with interrupts enabled.
+
+enum softirq_queue {
+    SOFTIRQ_HI,
+    SOFTIRQ_TIMER,
+    SOFTIRQ_BLOCK,
+    SOFTIRQ_RCU,
+    SOFTIRQ_LOG,
+    SOFTIRQ_QUEUES,
+};
+
+struct work_item {
+    struct work_item *next;
+    void (*fnc)(void *);
+    void *ext;
+    uint8_t pending;
+};
+
+#define WORK_ITEM_INIT(fnc, ext) { (void *)0, (fnc), (ext), 0 }
+
+void softirq_raise(enum softirq_queue queue, struct work_item *work);
+void softirq_run(void);
+int softirq_pending(void);
+int softirq_active(void);
+void softirq_dump(void);
+
+#endif
@@ -1,35 +1,150 @@
 #include "stdlib.h"
 #include "vmm.h"
+#include "pmm.h"
 
+#define STDLIB_WORD_THRESHOLD 16
+#define STDLIB_LARGE_THRESHOLD 512
+
+//null means the generic dword path below is the best we have
+void *(*memcpy_large)(void *dst, const void *src, size_t size) = (void *)0;
+void *(*memset_large)(void *dst, int chr, size_t size) = (void *)0;
+void (*zero_page)(void *page) = zero_page_stosd;
+
+//rep movs/stos based versions, the direction flag is always clear in kernel (cld on interrupt entry)
+void *memcpy_rep(void *dst, const void *src, size_t size) {
+    void *ret = dst;
+
+    if (size >= STDLIB_WORD_THRESHOLD) {
+        //align the destination, then move dwords
+        uint32_t head = (-(uintptr_t)dst) & 3;
+        uint32_t words;
+
+        size -= head;
+        asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) :: "memory");
+
+        words = size >> 2;
+        size &= 3;
+        asm volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) :: "memory");
+    }
+
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) :: "memory");
+    return (ret);
+}
+
+
+void *memset_rep(void* dst, int chr, size_t size) {
+    void *ret = dst;
+    uint32_t pattern = (uint8_t)chr * 0x01010101;
+
+    if (size >= STDLIB_WORD_THRESHOLD) {
+        uint32_t head = (-(uintptr_t)dst) & 3;
+        uint32_t words;
+
+        size -= head;
+        asm volatile("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+
+        words = size >> 2;
+        size &= 3;
+        asm volatile("rep stosl" : "+D"(dst), "+c"(words) : "a"(pattern) : "memory");
+    }
+
+    asm volatile("rep stosb" : "+D"(dst), "+c"(size) : "a"(pattern) : "memory");
+    return (ret);
+}
 
-uint8_t __stdlib_unsafe = 1;
 
 void *memcpy(void *dst, const void *src, unsigned long size) {
-    if (!__stdlib_unsafe && (__check_ptr_write(dst, size) || __check_ptr(src, size))) {
-        kprintf("memcpy ptr check fail at %s:%1d\n", __FILE__, __LINE__);
-        return (0);
+    if (size >= STDLIB_LARGE_THRESHOLD && memcpy_large != (void *)0) {
+        return memcpy_large(dst, src, size);
     }
 
-    char *destptr = (char *)dst;
-    const char *srcptr = (const char *)src;
-    while (size--) {
-        *destptr++ = *srcptr++;
+    return memcpy_rep(dst, src, size);
+}
+
+
+void *memset(void* dst, int chr, size_t size) {
+    if (size >= STDLIB_LARGE_THRESHOLD && memset_large != (void *)0) {
+        return memset_large(dst, chr, size);
+    }
+
+    return memset_rep(dst, chr, size);
+}
+
+
+void zero_page_stosd(void *page) {
+    uint32_t words = PAGE_SIZE / sizeof(uint32_t);
+    asm volatile("rep stosl" : "+D"(page), "+c"(words) : "a"(0) : "memory");
+}
+
+
+void *memmove(void *dst, const void *src, size_t size) {
+    //a forward copy is fine unless dst starts inside src
+    if ((uintptr_t)dst <= (uintptr_t)src || (uintptr_t)dst >= (uintptr_t)src + size) {
+        return memcpy_rep(dst, src, size);
     }
+
+    //backward: trailing bytes first, then dwords
+    void *d = (uint8_t *)dst + size - 1;
+    const void *s = (const uint8_t *)src + size - 1;
+    uint32_t tail = size & 3;
+    uint32_t words = size >> 2;
+
+    asm volatile(
+        "std\n"
+        "rep movsb\n"
+        "sub $3, %%edi\n"
+        "sub $3, %%esi\n"
+        "mov %3, %%ecx\n"
+        "rep movsl\n"
+        "cld"
+        : "+D"(d), "+S"(s), "+c"(tail) : "r"(words) : "memory"
+    );
+
     return (dst);
 }
 
 
-void *memset(void* dst, int chr, size_t size) {
-    if (!__stdlib_unsafe && __check_ptr(dst, size)) {
-        kprintf("memset ptr check fail at %s:%1d\n", __FILE__, __LINE__);
-        return (0);
+int memcmp(const void *s1, const void *s2, size_t size) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+
+    while (size >= sizeof(uint32_t) && *(const uint32_t *)p1 == *(const uint32_t *)p2) {
+        p1 += sizeof(uint32_t);
+        p2 += sizeof(uint32_t);
+        size -= sizeof(uint32_t);
     }
 
-    unsigned char *dstptr = (unsigned char *)dst;
     while (size--) {
-        *dstptr++ = (unsigned char)chr;
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+        p1++;
+        p2++;
     }
-    return (dst);
+
+    return (0);
+}
+
+
+//validating entry points, for pointers that are not trusted. Same rule as
+//__check_ptr_userspace but against vm_map, so lazy pages are fine
+void *memcpy_checked(void *dst, const void *src, unsigned long size) {
+    if (__check_ptr_vm_map(dst, size, VM_MAP_USER | VM_MAP_WRITE) || __check_ptr_vm_map(src, size, VM_MAP_USER)) {
+        kprintf("memcpy ptr check fail at %s:%1d\n", __FILE__, __LINE__);
+        return (0);
+    }
+
+    return memcpy(dst, src, size);
+}
+
+
+void *memset_checked(void* dst, int chr, size_t size) {
+    if (__check_ptr_vm_map(dst, size, VM_MAP_USER | VM_MAP_WRITE)) {
+        kprintf("memset ptr check fail at %s:%1d\n", __FILE__, __LINE__);
+        return (0);
+    }
+
+    return memset(dst, chr, size);
 }
 
 
@@ -53,4 +168,4 @@ void *bsearch_s(const void *key, const void *base, uint32_t num, uint32_t size,
     }
 
     return (void *)(0);
-}
\ No newline at end of file
+}
@@ -3,25 +3,69 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "klog.h"
 #define _HAVE_SIZE_T
 
 typedef int (*cmp_func_ext_t)(const void*, const void*, void*);
 
-extern uint8_t __stdlib_unsafe;
-
 void *memcpy(void *dst, const void *src, unsigned long size);
 void *memset(void* dst, int chr, size_t size);
+void *memmove(void *dst, const void *src, size_t size);
+int memcmp(const void *s1, const void *s2, size_t size);
 void *bsearch_s(const void *key, const void *base, uint32_t num, uint32_t size, cmp_func_ext_t cmp, void *ext);
 
-inline void *memset_unsafe(void* dst, int c, size_t size) {
-    __stdlib_unsafe = 1;
-    void * r = memset(dst, c, size);
-    __stdlib_unsafe = 0;
-    return r;
-}
+//same as memcpy/memset but check the range against vm_map first, for untrusted pointers
+void *memcpy_checked(void *dst, const void *src, unsigned long size);
+void *memset_checked(void* dst, int chr, size_t size);
+
+//generic dword versions, what memcpy/memset fall back to
+void *memcpy_rep(void *dst, const void *src, size_t size);
+void *memset_rep(void* dst, int chr, size_t size);
+
+//string.asm, the sse2 ones are only usable once sse is enabled and
+//inside kernel_fpu_begin/kernel_fpu_end (see fpu.c), on memory that can't fault
+void *memcpy_sse2(void *dst, const void *src, size_t size);
+void *memset_sse2(void *dst, int chr, size_t size);
+void *memcpy_erms(void *dst, const void *src, size_t size);
+void *memset_erms(void *dst, int chr, size_t size);
+void zero_page_sse2(void *page);
+void zero_page_stosd(void *page);
+
+//selected at boot by cpu_init for the host cpu
+extern void *(*memcpy_large)(void *dst, const void *src, size_t size);
+extern void *(*memset_large)(void *dst, int chr, size_t size);
+extern void (*zero_page)(void *page);
 
-void kprintf(const char *format, ...);
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+//64 by 32 bit division with two divl, there is no libgcc for __udivdi3
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder) {
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend;
+    uint32_t q_high = high / divisor;
+    uint32_t q_low, rem;
+
+    high %= divisor;
+    asm("divl %4" : "=a"(q_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+    if (remainder) {
+        *remainder = rem;
+    }
+
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    return div_u64_rem(dividend, divisor, (void *)0);
+}
+
+//(value * mult) >> shift without losing the top bits of the 96 bit product
+static inline uint64_t mul_u64_u32_shr(uint64_t value, uint32_t mult, uint32_t shift) {
+    uint64_t low = (uint64_t)(uint32_t)value * mult;
+    uint64_t high = (uint64_t)(uint32_t)(value >> 32) * mult;
+
+    return (low >> shift) + (shift < 32 ? high << (32 - shift) : high >> (shift - 32));
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+; string.asm
+; cpu specific versions of the stdlib memory primitives, for large sizes.
+; cpu_init picks between them. the sse2 ones need cr4.osfxsr set.
+
+bits 32
+section .text
+
+; void *memcpy_sse2(void *dst, const void *src, size_t size)
+global memcpy_sse2
+memcpy_sse2:
+	push edi
+	push esi
+	mov edi, [esp + 12]
+	mov esi, [esp + 16]
+	mov ecx, [esp + 20]
+	mov eax, edi
+
+	; align destination on 16 bytes
+	mov edx, edi
+	neg edx
+	and edx, 15
+	cmp ecx, edx
+	jb .tail
+	sub ecx, edx
+	xchg ecx, edx
+	rep movsb
+	mov ecx, edx
+
+	mov edx, ecx
+	shr edx, 6 ; 64 bytes per loop
+	jz .tail
+.loop:
+	movdqu xmm0, [esi]
+	movdqu xmm1, [esi + 16]
+	movdqu xmm2, [esi + 32]
+	movdqu xmm3, [esi + 48]
+	movdqa [edi], xmm0
+	movdqa [edi + 16], xmm1
+	movdqa [edi + 32], xmm2
+	movdqa [edi + 48], xmm3
+	add esi, 64
+	add edi, 64
+	dec edx
+	jnz .loop
+	and ecx, 63
+.tail:
+	rep movsb
+	pop esi
+	pop edi
+	ret
+
+; void *memset_sse2(void *dst, int c, size_t size)
+global memset_sse2
+memset_sse2:
+	push edi
+	mov edi, [esp + 8]
+	movzx eax, byte [esp + 12]
+	mov ecx, [esp + 16]
+	imul eax, eax, 0x01010101
+
+	; align destination on 16 bytes
+	mov edx, edi
+	neg edx
+	and edx, 15
+	cmp ecx, edx
+	jb .tail
+	sub ecx, edx
+	xchg ecx, edx
+	rep stosb
+	mov ecx, edx
+
+	movd xmm0, eax
+	pshufd xmm0, xmm0, 0
+	mov edx, ecx
+	shr edx, 6 ; 64 bytes per loop
+	jz .tail
+.loop:
+	movdqa [edi], xmm0
+	movdqa [edi + 16], xmm0
+	movdqa [edi + 32], xmm0
+	movdqa [edi + 48], xmm0
+	add edi, 64
+	dec edx
+	jnz .loop
+	and ecx, 63
+.tail:
+	rep stosb
+	mov eax, [esp + 8]
+	pop edi
+	ret
+
+; void zero_page_sse2(void *page)
+; non temporal stores, a freshly zeroed page is rarely read right away
+global zero_page_sse2
+zero_page_sse2:
+	mov eax, [esp + 4]
+	mov ecx, 4096 / 64
+	pxor xmm0, xmm0
+.loop:
+	movntdq [eax], xmm0
+	movntdq [eax + 16], xmm0
+	movntdq [eax + 32], xmm0
+	movntdq [eax + 48], xmm0
+	add eax, 64
+	dec ecx
+	jnz .loop
+	sfence
+	ret
+
+; void *memcpy_erms(void *dst, const void *src, size_t size)
+; with erms a plain rep movsb is the fastest way for large copies
+global memcpy_erms
+memcpy_erms:
+	push edi
+	push esi
+	mov edi, [esp + 12]
+	mov esi, [esp + 16]
+	mov ecx, [esp + 20]
+	mov eax, edi
+	rep movsb
+	pop esi
+	pop edi
+	ret
+
+; void *memset_erms(void *dst, int c, size_t size)
+global memset_erms
+memset_erms:
+	push edi
+	mov edi, [esp + 8]
+	mov eax, [esp + 12]
+	mov ecx, [esp + 16]
+	rep stosb
+	mov eax, [esp + 8]
+	pop edi
+	ret
@@ -0,0 +1,43 @@
+; kernel side task switch
+;
+; a switched out task's kernel stack holds, from its saved esp up: edi, esi,
+; ebx, ebp (the registers the c calling convention wants preserved) and the
+; address switch_context returns to. A new task (see task_spawn) starts
+; with zeroed registers, task_user_entry as return address and an iret
+; frame to its program's entry point above it.
+
+section .text
+
+; void switch_context(uint32_t *prev_esp, uint32_t next_esp)
+global switch_context
+switch_context:
+	mov eax, [esp + 4]
+	mov edx, [esp + 8]
+
+	push ebp
+	push ebx
+	push esi
+	push edi
+
+	mov [eax], esp
+	mov esp, edx
+
+	pop edi
+	pop esi
+	pop ebx
+	pop ebp
+	ret
+
+extern kernel_unlock
+
+; first run of a task, the iret frame is on the stack. Interrupts are off,
+; the kernel lock taken by whoever switched here is dropped on the way out
+global task_user_entry
+task_user_entry:
+	call kernel_unlock
+	mov ax, 0x23
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	iret
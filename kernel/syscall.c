@@ -2,37 +2,250 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "vmm.h"
+#include "heap_profile.h"
+#include "arena.h"
+#include "klog.h"
+#include "console.h"
+#include "cpu.h"
+#include "ring.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "task.h"
 
 enum {
     SYSCALL_EXIT = 66,
     SYSCALL_WRITE = 42,
+    SYSCALL_HEAP_STATS = 70,
+    SYSCALL_SYSCALL_STATS = 71,
+    SYSCALL_RING_SETUP = 72,
+    SYSCALL_RING_ENTER = 73,
+    SYSCALL_IRQ_STATS = 74,
+    SYSCALL_SPAWN = 75,
+    SYSCALL_WAIT = 76,
+    SYSCALL_YIELD = 77,
+    SYSCALL_GETPID = 78,
 };
 
-extern int put(char c);
+typedef int32_t (*syscall_t)(const uint32_t *args);
+
+struct syscall_desc {
+    syscall_t fnc;
+    const char *name;
+    uint8_t argc;
+};
+
+#define SYSCALL_MAX 79
+#define SYSCALL_HIST_BUCKETS 32 //log2 of the cycles spent
+
+#ifdef SYSCALL_STATS
+struct syscall_stats {
+    uint32_t calls;
+    uint32_t errors;
+    uint64_t cycles;
+    uint32_t histogram[SYSCALL_HIST_BUCKETS];
+};
+
+static struct syscall_stats syscall_stats[SYSCALL_MAX];
+#endif
+
+static const struct syscall_desc syscall_table[SYSCALL_MAX];
 
 static int32_t syscall_write(const void *buffer, size_t buffer_sz) {
     if (__check_ptr_userspace(buffer, buffer_sz)) {
         return (-1);
     }
 
-    uint32_t index;
-    for (index = 0; index < buffer_sz; index++) {
-        put(((char *)buffer)[index]);
-    }
+    //keep the order with what the kernel logged before
+    klog_flush();
+
+    console_write(buffer, buffer_sz);
 
-    return index;
+    return buffer_sz;
 }
 
 static int32_t syscall_exit(uint32_t code) {
-    kprintf("task finished with return code %d\n", code);
-    while(1) {}
+    kprintf("task %d finished with return code %d\n", current->pid, code);
+    task_exit(code);
+}
+
+static int32_t syscall_spawn(const char *path) {
+    char buffer[TASK_PATH_MAX];
+    uint32_t len;
+
+    for (len = 0; len < TASK_PATH_MAX; len++) {
+        if (__check_ptr_userspace(path + len, 1)) {
+            return (-1);
+        }
+        buffer[len] = path[len];
+        if (buffer[len] == '\0') {
+            break;
+        }
+    }
+
+    if (len == TASK_PATH_MAX) {
+        return (-1);
+    }
+
+    struct task *task = task_spawn(buffer, TASK_PRIORITY_DEFAULT);
+    return task != (void *)0 ? task->pid : -1;
+}
+
+static int32_t syscall_wait(int32_t pid, int32_t *status) {
+    int32_t code;
+
+    if (status != (void *)0 && __check_ptr_userspace(status, sizeof(int32_t))) {
+        return (-1);
+    }
+
+    pid = task_wait(pid, &code);
+    if (pid >= 0 && status != (void *)0) {
+        *status = code;
+    }
+
+    return pid;
+}
+
+static int32_t syscall_yield(void) {
+    sched_yield();
+    return (0);
+}
+
+static int32_t syscall_getpid(void) {
+    return current->pid;
+}
+
+static int32_t syscall_heap_stats(void) {
+    heap_profile_dump();
+    return (0);
+}
+
+void syscall_stats_dump() {
+    kprintf("\n=== SYSCALL STATS ===\n");
+
+#ifdef SYSCALL_STATS
+    kprintf("no name argc calls errors cycles\n");
+    for (uint32_t i = 0; i < SYSCALL_MAX; i++) {
+        struct syscall_stats *stats = &syscall_stats[i];
+        if (syscall_table[i].fnc == (void *)0 || stats->calls == 0) {
+            continue;
+        }
+
+        kprintf("%2d %s %1d %8d %8d 0x%h%8h\n", i, syscall_table[i].name, syscall_table[i].argc,
+                stats->calls, stats->errors, (uint32_t)(stats->cycles >> 32), (uint32_t)stats->cycles);
+        kprintf("  cycles:");
+        for (uint32_t b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+            if (stats->histogram[b] != 0) {
+                kprintf(" 2^%1d:%1d", b, stats->histogram[b]);
+            }
+        }
+        kprintf("\n");
+    }
+#else
+    kprintf("not compiled in (SYSCALL_STATS=1)\n");
+#endif
+}
+
+static int32_t syscall_syscall_stats(void) {
+    syscall_stats_dump();
+    return (0);
+}
+
+static int32_t syscall_irq_stats(void) {
+    interrupt_stats_dump();
+    softirq_dump();
+    return (0);
+}
+
+static int32_t syscall_ring_setup(uint32_t entries, uint32_t flags) {
+    return ring_setup(entries, flags);
+}
+
+static int32_t syscall_ring_enter(uint32_t to_submit, uint32_t min_complete) {
+    return ring_enter(to_submit, min_complete);
+}
+
+//adapters from the raw register arguments to the typed implementations
+#define SYSCALL_DEFINE0(fn) \
+static int32_t sys_##fn(const uint32_t *args __attribute__((unused))) { \
+    return syscall_##fn(); \
+}
+
+#define SYSCALL_DEFINE1(fn, T1) \
+static int32_t sys_##fn(const uint32_t *args) { \
+    return syscall_##fn((T1)args[0]); \
+}
+
+#define SYSCALL_DEFINE2(fn, T1, T2) \
+static int32_t sys_##fn(const uint32_t *args) { \
+    return syscall_##fn((T1)args[0], (T2)args[1]); \
 }
 
+SYSCALL_DEFINE2(write, const void *, size_t)
+SYSCALL_DEFINE1(exit, uint32_t)
+SYSCALL_DEFINE0(heap_stats)
+SYSCALL_DEFINE0(syscall_stats)
+SYSCALL_DEFINE2(ring_setup, uint32_t, uint32_t)
+SYSCALL_DEFINE2(ring_enter, uint32_t, uint32_t)
+SYSCALL_DEFINE0(irq_stats)
+SYSCALL_DEFINE1(spawn, const char *)
+SYSCALL_DEFINE2(wait, int32_t, int32_t *)
+SYSCALL_DEFINE0(yield)
+SYSCALL_DEFINE0(getpid)
+
+static const struct syscall_desc syscall_table[SYSCALL_MAX] = {
+    [SYSCALL_WRITE] = { sys_write, "write", 2 },
+    [SYSCALL_EXIT] = { sys_exit, "exit", 1 },
+    [SYSCALL_HEAP_STATS] = { sys_heap_stats, "heap_stats", 0 },
+    [SYSCALL_SYSCALL_STATS] = { sys_syscall_stats, "syscall_stats", 0 },
+    [SYSCALL_RING_SETUP] = { sys_ring_setup, "ring_setup", 2 },
+    [SYSCALL_RING_ENTER] = { sys_ring_enter, "ring_enter", 2 },
+    [SYSCALL_IRQ_STATS] = { sys_irq_stats, "irq_stats", 0 },
+    [SYSCALL_SPAWN] = { sys_spawn, "spawn", 1 },
+    [SYSCALL_WAIT] = { sys_wait, "wait", 2 },
+    [SYSCALL_YIELD] = { sys_yield, "yield", 0 },
+    [SYSCALL_GETPID] = { sys_getpid, "getpid", 0 },
+};
+
+#ifdef SYSCALL_STATS
+static void syscall_account(uint32_t syscallno, int32_t ret, uint64_t start) {
+    struct syscall_stats *stats = &syscall_stats[syscallno];
+    uint64_t cycles = rdtsc() - start;
+    uint32_t bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+
+    stats->calls++;
+    if (ret < 0) {
+        stats->errors++;
+    }
+    stats->cycles += cycles;
+    stats->histogram[min(bucket, SYSCALL_HIST_BUCKETS - 1)]++;
+}
+#endif
+
+//entered from int 0x80 (interrupt.c) and sysenter (sysenter.asm)
 int32_t syscall_handler(uint32_t syscallno, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    switch (syscallno) {
-        case SYSCALL_WRITE:
-            return syscall_write((const void *)arg1, (size_t)arg2);
-        case SYSCALL_EXIT:
-            return syscall_exit(arg1);
+    if (syscallno >= SYSCALL_MAX || syscall_table[syscallno].fnc == (void *)0) {
+        return (-1);
     }
-}
\ No newline at end of file
+
+    const struct syscall_desc *desc = &syscall_table[syscallno];
+    const uint32_t args[5] = { arg1, arg2, arg3, arg4, arg5 };
+
+    klog_debug("syscall %s(0x%h, 0x%h, 0x%h) argc %1d\n", desc->name, arg1, arg2, arg3, desc->argc);
+
+#ifdef SYSCALL_STATS
+    uint64_t start = rdtsc();
+#endif
+
+    //whatever a syscall takes from the scratch arena is gone once it returns
+    struct arena *scratch = arena_scratch();
+    arena_mark_t mark = arena_mark(scratch);
+    int32_t ret = desc->fnc(args);
+
+    arena_reset(scratch, mark);
+
+#ifdef SYSCALL_STATS
+    syscall_account(syscallno, ret, start);
+#endif
+
+    return ret;
+}
@@ -0,0 +1,88 @@
+; fast system call entry
+;
+; user side (userspace/syscall.asm): eax = syscall number, ebx, esi, edi =
+; arguments 1, 4, 5; ecx, edx (arguments 2, 3), ebp and the return address
+; are pushed on the user stack and ebp points to them:
+;   [ebp] return eip, [ebp + 4] ebp, [ebp + 8] edx, [ebp + 12] ecx
+; sysexit resumes at [ebp] with esp = ebp + 4
+
+extern syscall_handler
+extern softirq_run
+extern sched_preempt
+extern kernel_lock
+extern kernel_unlock
+extern kprintf
+extern task_exit
+
+%define KERNEL_BASE 0xC0000000
+%define SYSENTER_FRAME 16
+%define FLAT_DS 0x23 ; what the kernel and tasks run with (task_user_entry)
+%define PERCPU_SEL 0x30 ; SMP_PERCPU_SEL (smp.h)
+%define CPU_INTERRUPT_NESTING 4 ; offsetof(struct cpu, interrupt_nesting)
+
+section .text
+
+global sysenter_entry
+sysenter_entry:
+	mov esp, [esp - 4] ; the msr points right after tss.esp0
+	cld
+
+	; this cpu's per cpu area, the same selector in every cpu's gdt
+	push gs
+	push eax
+	mov ax, PERCPU_SEL
+	mov gs, ax
+	pop eax
+
+	cmp ebp, KERNEL_BASE - SYSENTER_FRAME
+	ja .bad_frame
+
+	push ebp
+	push eax
+	call kernel_lock ; interrupts are still off, as sysenter left them
+	pop eax
+	inc dword [gs:CPU_INTERRUPT_NESTING]
+
+	push edi
+	push esi
+	push dword [ebp + 8]
+	push dword [ebp + 12]
+	push ebx
+	push eax
+	call syscall_handler
+	add esp, 24
+
+	dec dword [gs:CPU_INTERRUPT_NESTING]
+	push eax
+	call softirq_run
+	call sched_preempt ; may switch to another task, back here once this one runs again
+	call kernel_unlock
+	pop eax
+
+	pop ecx
+	pop gs
+	mov edx, [ecx]
+	add ecx, 4
+	sti ; takes effect after sysexit, no interrupt can come in between
+	sysexit
+
+.bad_frame:
+	; nowhere to return to: the task dies, the cpu goes on with the next one.
+	; userspace may have left anything in the data segments
+	mov ax, FLAT_DS
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	call kernel_lock
+	inc dword [gs:CPU_INTERRUPT_NESTING] ; as in a syscall, task_exit switches away from here
+
+	push ebp
+	push .msg
+	call kprintf
+	add esp, 8
+
+	push dword -1
+	call task_exit ; doesn't return
+
+section .rodata
+.msg: db "sysenter: bad user stack 0x%8h, killing the task", 10, 0
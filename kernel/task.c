@@ -0,0 +1,396 @@
+#include <stdint.h>
+#include "task.h"
+#include "smp.h"
+#include "elf.h"
+#include "fat.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "io.h"
+#include "fpu.h"
+#include "klog.h"
+#include "clocksource.h"
+#include "liballoc.h"
+#include "stdlib.h"
+#include "arena.h"
+#include "ring.h"
+
+// Task table and life cycle. A task runs one program from the fat
+// filesystem, it is loaded like kmain used to load INIT: the PT_LOAD
+// segments are file mappings faulted in on demand. Since everything lives
+// in the one address space, two programs linked at the same address can't
+// run together (the second spawn fails). User stacks sit under the kernel,
+// one 64 KB slot per task (the vdso page falls between the first two).
+
+#define TASK_USTACK_PAGES 3
+#define TASK_USTACK_AREA 0x10000
+#define TASK_USTACK_TOP(slot) (0xC0000000 - ((slot) - 1) * TASK_USTACK_AREA) //slot 1 gets INIT's old stack
+#define TASK_PATH_DEPTH 8
+
+#define TASK_USER_CS 0x1B
+#define TASK_USER_DS 0x23
+
+extern void task_user_entry(void); //switch.asm
+
+static struct task tasks[TASK_MAX];
+static int32_t next_pid = 1;
+
+static const char *task_state_names[] = {
+    [TASK_FREE] = "free",
+    [TASK_READY] = "ready",
+    [TASK_RUNNING] = "running",
+    [TASK_BLOCKED] = "blocked",
+    [TASK_ZOMBIE] = "zombie",
+};
+
+//the boot context becomes the boot cpu's idle task
+void task_init() {
+    struct task *idle = &tasks[0];
+
+    memset(tasks, 0, sizeof(tasks));
+
+    idle->pid = 0;
+    idle->state = TASK_RUNNING;
+    idle->priority = TASK_PRIORITIES - 1;
+    idle->switched_in_ns = ktime_get_ns();
+    idle->cpu = 0;
+    memcpy(idle->name, "idle", 5);
+
+    cpus[0].idle = idle;
+    cpus[0].curr = idle;
+    sched_init_cpu(0);
+    fpu_switch(&idle->fpu);
+}
+
+//an application processor's idle task, running on the given boot stack
+struct task *task_idle_create(uint32_t cpu, void *stack) {
+    struct task *task = (void *)0;
+    unsigned int flags = irq_save();
+
+    for (uint32_t slot = 1; slot < TASK_MAX; slot++) {
+        if (tasks[slot].state == TASK_FREE) {
+            task = &tasks[slot];
+            memset(task, 0, sizeof(struct task));
+            task->pid = 0;
+            task->state = TASK_RUNNING;
+            task->priority = TASK_PRIORITIES - 1;
+            task->kstack = stack;
+            task->cpu = cpu;
+            task->lock_depth = 1;
+            task->switched_in_ns = ktime_get_ns();
+            memcpy(task->name, "idle", 5);
+            break;
+        }
+    }
+
+    irq_restore(flags);
+    return task;
+}
+
+//splits path in place on '/', 1 if there are too many components
+static int task_split_path(char *path, char *components[], uint32_t max) {
+    uint32_t count = 0;
+
+    while (*path != '\0') {
+        if (*path == '/') {
+            *path++ = '\0';
+            continue;
+        }
+
+        if (count == max - 1) {
+            return (1);
+        }
+        components[count++] = path;
+
+        while (*path != '\0' && *path != '/') {
+            path++;
+        }
+    }
+
+    components[count] = (void *)0;
+    return count == 0;
+}
+
+static int task_add_region(struct task *task, void *base) {
+    for (uint32_t i = 0; i < TASK_MAX_REGIONS; i++) {
+        if (task->regions[i] == (void *)0) {
+            task->regions[i] = base;
+            return (0);
+        }
+    }
+
+    rm_vm_entry(base);
+    return (1);
+}
+
+static void task_free_regions(struct task *task) {
+    for (uint32_t i = 0; i < TASK_MAX_REGIONS; i++) {
+        if (task->regions[i] != (void *)0) {
+            rm_vm_entry(task->regions[i]);
+            task->regions[i] = (void *)0;
+        }
+    }
+}
+
+//maps the program's segments, returns its entry point or 0
+static uint32_t task_load(struct task *task, char *path[]) {
+    struct fat_sector_itearator sec;
+    struct elf_header elfhead;
+    struct elf_phrd section;
+
+    if (fat_open_from_path(&sec, path) != 0) {
+        klog_error("task: %s not found\n", task->name);
+        return (0);
+    }
+
+    fat_open(&task->file, &sec);
+    fat_read(&task->file, &elfhead, sizeof(struct elf_header));
+    if (elfhead.ident[0] != 0x7f ||
+        elfhead.ident[1] != 'E' ||
+        elfhead.ident[2] != 'L' ||
+        elfhead.ident[3] != 'F' ||
+        elfhead.ident[4] != 1 ||
+        elfhead.ident[5] != 1) {
+        klog_error("task: %s: elf header error\n", task->name);
+        return (0);
+    }
+
+    if (sizeof(struct elf_phrd) != elfhead.phentsize) {
+        klog_error("task: %s: program header size issue (%1d != %1d)\n", task->name, sizeof(struct elf_phrd), elfhead.phentsize);
+        return (0);
+    }
+
+    fat_seek(&task->file, elfhead.phoff, SEEK_SET);
+    for (uint16_t i = 0; i < elfhead.phnum; i++) {
+        fat_read(&task->file, &section, sizeof(struct elf_phrd));
+
+        if (section.type != ELF_PT_LOAD) {
+            continue;
+        }
+
+        void *base = add_vm_entry((void *)section.vaddr, section.memsz, VM_MAP_FILE | VM_MAP_WRITE | VM_MAP_USER, &task->file, section.offset, section.filesz);
+        if (base != (void *)section.vaddr) {
+            klog_error("task: %s: unable to map 0x%8h\n", task->name, section.vaddr);
+            if (base != (void *)0) {
+                rm_vm_entry(base);
+            }
+            return (0);
+        }
+
+        if (task_add_region(task, base) != 0) {
+            klog_error("task: %s: too many segments\n", task->name);
+            return (0);
+        }
+    }
+
+    return elfhead.entry;
+}
+
+//what switch_context pops for a task that never ran: 4 zeroed registers,
+//then task_user_entry's iret to the program
+static void task_setup_stack(struct task *task, uint32_t entry, uint32_t user_esp) {
+    uint32_t *sp = (uint32_t *)((uint8_t *)task->kstack + TASK_KSTACK_SIZE);
+
+    *--sp = TASK_USER_DS; //ss
+    *--sp = user_esp;
+    *--sp = EFLAGS_IF | 0x2; //bit 1 is always set
+    *--sp = TASK_USER_CS;
+    *--sp = entry;
+    *--sp = (uint32_t)task_user_entry;
+    for (uint32_t i = 0; i < 4; i++) {
+        *--sp = 0; //ebp, ebx, esi, edi
+    }
+
+    task->esp = (uint32_t)sp;
+    task->lock_depth = 1; //task_user_entry drops it
+}
+
+static void task_release(struct task *task) {
+    if (task->kstack != (void *)0) {
+        free(task->kstack);
+    }
+    arena_destroy(&task->scratch);
+    memset(task, 0, sizeof(struct task));
+}
+
+struct task *task_spawn(const char *path, uint8_t priority) {
+    char buffer[TASK_PATH_MAX];
+    char *components[TASK_PATH_DEPTH];
+    struct task *task = (void *)0;
+    uint32_t slot;
+    uint32_t len = 0;
+
+    while (path[len] != '\0' && len < TASK_PATH_MAX - 1) {
+        buffer[len] = path[len];
+        len++;
+    }
+    buffer[len] = '\0';
+
+    if (path[len] != '\0' || task_split_path(buffer, components, TASK_PATH_DEPTH) != 0 || priority >= TASK_PRIORITIES) {
+        return (void *)0;
+    }
+
+    unsigned int flags = irq_save();
+    for (slot = 1; slot < TASK_MAX; slot++) {
+        if (tasks[slot].state == TASK_FREE) {
+            task = &tasks[slot];
+            memset(task, 0, sizeof(struct task));
+            task->state = TASK_BLOCKED; //taken, not runnable until loaded
+            task->pid = next_pid++;
+            break;
+        }
+    }
+    irq_restore(flags);
+
+    if (task == (void *)0) {
+        klog_warn("task: no free slot for %s\n", path);
+        return (void *)0;
+    }
+
+    const char *name = components[0];
+    for (uint32_t i = 1; components[i] != (void *)0; i++) {
+        name = components[i];
+    }
+    for (uint32_t i = 0; i < TASK_NAME_LEN - 1 && name[i] != '\0'; i++) {
+        task->name[i] = name[i];
+    }
+
+    task->priority = priority;
+    task->parent = current != idle_task ? current : (void *)0; //nobody waits for it
+
+    //touched now, a fault on the kernel stack in the middle of an interrupt entry would be fatal
+    task->kstack = malloc(TASK_KSTACK_SIZE);
+    if (task->kstack == (void *)0) {
+        goto fail;
+    }
+    memset(task->kstack, 0, TASK_KSTACK_SIZE);
+
+    if (arena_init_scratch(&task->scratch) != 0) {
+        goto fail;
+    }
+
+    uint32_t entry = task_load(task, components);
+    if (entry == 0) {
+        goto fail;
+    }
+
+    uint32_t stack_top = TASK_USTACK_TOP(slot);
+    void *stack = add_vm_entry((void *)(stack_top - TASK_USTACK_PAGES * PAGE_SIZE), TASK_USTACK_PAGES * PAGE_SIZE,
+                               VM_MAP_ANONYMOUS | VM_MAP_USER | VM_MAP_WRITE, 0, 0, 0);
+    if (stack != (void *)(stack_top - TASK_USTACK_PAGES * PAGE_SIZE)) {
+        klog_error("task: %s: unable to map its stack\n", task->name);
+        if (stack != (void *)0) {
+            rm_vm_entry(stack);
+        }
+        goto fail;
+    }
+    if (task_add_region(task, stack) != 0) {
+        goto fail;
+    }
+
+    task_setup_stack(task, entry, stack_top - 16);
+    klog_info("task: %d %s, entry 0x%8h\n", task->pid, task->name, entry);
+
+    sched_enqueue(task);
+    return task;
+
+fail:
+    task_free_regions(task);
+    task_release(task);
+    return (void *)0;
+}
+
+void task_exit(int32_t code) {
+    struct task *task = current;
+
+    ring_destroy(task->ring);
+    task->ring = (void *)0;
+    task_free_regions(task);
+    fpu_release(&task->fpu);
+
+    asm volatile("cli" ::: "memory");
+
+    task->exit_code = code;
+    task->state = TASK_ZOMBIE;
+
+    //the idle tasks reap what nobody waits for
+    for (uint32_t i = 1; i < TASK_MAX; i++) {
+        if (tasks[i].state != TASK_FREE && tasks[i].parent == task) {
+            tasks[i].parent = (void *)0;
+        }
+    }
+
+    if (task->parent != (void *)0) {
+        wait_queue_wake(&task->parent->child_exit);
+    }
+
+    schedule();
+    __builtin_unreachable();
+}
+
+//waits for the child pid (any child if -1) to exit, -1 if there is none
+int32_t task_wait(int32_t pid, int32_t *status) {
+    unsigned int flags = irq_save();
+
+    for (;;) {
+        struct task *zombie = (void *)0;
+        uint32_t children = 0;
+
+        for (uint32_t i = 1; i < TASK_MAX; i++) {
+            struct task *task = &tasks[i];
+
+            if (task->state == TASK_FREE || task->parent != current || (pid != -1 && task->pid != pid)) {
+                continue;
+            }
+
+            children++;
+            if (task->state == TASK_ZOMBIE) {
+                zombie = task;
+                break;
+            }
+        }
+
+        if (zombie != (void *)0) {
+            int32_t zombie_pid = zombie->pid;
+
+            if (status != (void *)0) {
+                *status = zombie->exit_code;
+            }
+            task_release(zombie);
+            irq_restore(flags);
+            return zombie_pid;
+        }
+
+        if (children == 0) {
+            irq_restore(flags);
+            return (-1);
+        }
+
+        wait_queue_sleep(&current->child_exit);
+    }
+}
+
+//from the idle loop, with interrupts off
+void task_reap_orphans() {
+    for (uint32_t i = 1; i < TASK_MAX; i++) {
+        if (tasks[i].state == TASK_ZOMBIE && tasks[i].parent == (void *)0) {
+            klog_info("task: %d %s exited with %d\n", tasks[i].pid, tasks[i].name, tasks[i].exit_code);
+            task_release(&tasks[i]);
+        }
+    }
+}
+
+void task_dump() {
+    kprintf("\n=== TASKS ===\n");
+    kprintf("pid state prio switches runtime_ms name\n");
+
+    for (uint32_t i = 0; i < TASK_MAX; i++) {
+        struct task *task = &tasks[i];
+
+        if (task->state == TASK_FREE) {
+            continue;
+        }
+
+        kprintf("%3d %s %2d %8d %8d %s\n", task->pid, task_state_names[task->state], task->priority,
+                task->switches, (uint32_t)div_u64(task->runtime_ns, NSEC_PER_MSEC), task->name);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __TASK__
+#define __TASK__
+
+#include <stdint.h>
+#include "fpu.h"
+#include "fat.h"
+#include "arena.h"
+
+// Tasks share the one address space: a program is loaded where its elf
+// asks, and spawning fails if that is already taken. Each task has its own
+// kernel stack (tss.esp0 follows the running task), user stack and fpu
+// state. Every cpu has an idle task (pid 0), the boot processor's runs on
+// the boot stack.
+
+#define TASK_MAX 32
+#define TASK_NAME_LEN 16
+#define TASK_KSTACK_SIZE 8192
+#define TASK_MAX_REGIONS 8
+#define TASK_PATH_MAX 64
+
+//0 is the highest, the idle task is not queued
+#define TASK_PRIORITIES 32
+#define TASK_PRIORITY_DEFAULT 16
+
+#define TASK_TIMESLICE_MS 10
+
+enum task_state {
+    TASK_FREE,
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_BLOCKED,
+    TASK_ZOMBIE,
+};
+
+struct task;
+struct ring;
+
+struct wait_queue {
+    struct task *head;
+    struct task *tail;
+};
+
+struct task {
+    struct fpu_state fpu; //first, it has to be 16 bytes aligned
+    uint32_t esp; //kernel stack pointer while switched out
+    uint32_t nesting; //interrupt_nesting while switched out
+    uint32_t lock_depth; //kernel lock depth while switched out
+    uint32_t cpu; //where it runs or ran last
+    int32_t pid;
+    enum task_state state;
+    uint8_t priority;
+    struct task *next; //in a run queue or a wait queue
+    struct task *parent;
+    struct wait_queue child_exit;
+    int32_t exit_code;
+
+    void *kstack; //0 for the idle task
+    void *regions[TASK_MAX_REGIONS]; //its mappings, removed at exit
+    struct file file; //backs the program's file mappings
+    struct arena scratch; //arena_scratch() while it runs
+    struct ring *ring; //ring_setup, 0 if none
+
+    uint64_t runtime_ns;
+    uint64_t switched_in_ns;
+    uint32_t switches;
+    char name[TASK_NAME_LEN];
+};
+
+//one per cpu: a fifo per priority and a bitmap of the non empty ones
+struct run_queue {
+    struct task *head[TASK_PRIORITIES];
+    struct task *tail[TASK_PRIORITIES];
+    uint32_t bitmap; //bit n: head[n] isn't empty
+    uint32_t count;
+};
+
+//task.c
+void task_init(void);
+struct task *task_idle_create(uint32_t cpu, void *stack);
+struct task *task_spawn(const char *path, uint8_t priority);
+void task_exit(int32_t code) __attribute__((noreturn));
+int32_t task_wait(int32_t pid, int32_t *status);
+void task_reap_orphans(void);
+void task_dump(void);
+
+//sched.c
+void sched_enqueue(struct task *task);
+void schedule(void);
+void sched_yield(void);
+void sched_preempt(void);
+void sched_idle(void) __attribute__((noreturn));
+int sched_can_block(void);
+void sched_init_cpu(uint32_t cpu);
+void sched_dump(void);
+struct spinlock;
+
+void wait_queue_sleep(struct wait_queue *queue);
+void wait_queue_sleep_unlock(struct wait_queue *queue, struct spinlock *lock);
+void wait_queue_wake(struct wait_queue *queue);
+
+#include "smp.h" //current, idle_task
+
+#endif
@@ -0,0 +1,429 @@
+#include <stdint.h>
+#include "timer.h"
+#include "pit.h"
+#include "apic.h"
+#include "clocksource.h"
+#include "io.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "task.h"
+#include "smp.h"
+#include "stdlib.h"
+#include "selftest.h"
+
+// Hierarchical timer wheel: 4 levels of 64 slots, level n slots are 64^n ms
+// wide. A timer goes in the level its distance falls in and moves down
+// (cascades) when the clock reaches its slot of the upper level, so add and
+// cancel are O(1). Timers further than the wheel reach are parked in the
+// last level until they come in range.
+//
+// With a continuous clocksource the time is read from it and the clock
+// event is set in one shot mode for the nearest deadline (tickless).
+// Without one the time only moves with a periodic tick, which is then
+// the clocksource itself.
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_DELTA (((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+#define TIMER_PERIODIC_HZ 100
+#define TIMER_CALIBRATE_MS 10
+
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+static struct timer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t wheel_bitmap[TIMER_LEVELS]; //non empty slots
+static uint64_t wheel_clk; //next ms to process
+
+static struct clock_event *clock_event = (void *)0;
+static uint8_t tickless = 0;
+static uint64_t next_event; //when the one shot fires
+static volatile uint64_t jiffies_ms; //periodic mode time
+
+static uint32_t lapic_ticks_per_ms;
+
+static void pit_set_next(uint32_t ms) {
+    pit_oneshot(ms);
+}
+
+static void pit_set_periodic(uint32_t hz) {
+    pit_periodic(hz);
+}
+
+static struct clock_event pit_clock_event = {
+    .name = "pit",
+    .vector = PIT_INTERRUPT,
+    .max_delta_ms = PIT_MAX_MS,
+    .set_next = pit_set_next,
+    .set_periodic = pit_set_periodic,
+};
+
+static void lapic_set_next(uint32_t ms) {
+    lapic_write(LAPIC_LVT_TIMER, IRQ_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, ms * lapic_ticks_per_ms);
+}
+
+static void lapic_set_periodic(uint32_t hz) {
+    lapic_write(LAPIC_LVT_TIMER, IRQ_LAPIC_TIMER | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_ticks_per_ms * (1000 / hz));
+}
+
+static struct clock_event lapic_clock_event = {
+    .name = "lapic",
+    .vector = IRQ_LAPIC_TIMER,
+    .set_next = lapic_set_next,
+    .set_periodic = lapic_set_periodic,
+};
+
+//count down from the max during a known pit interval
+static uint32_t lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IRQ_LAPIC_TIMER);
+
+    pit_gate_start(TIMER_CALIBRATE_MS);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    while (!pit_gate_done()) {}
+    uint32_t count = lapic_read(LAPIC_TIMER_CURRENT);
+    pit_gate_stop();
+
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    return (0xFFFFFFFF - count) / TIMER_CALIBRATE_MS;
+}
+
+static uint64_t jiffies_read(void) {
+    unsigned int flags = irq_save();
+    uint64_t now = jiffies_ms;
+    irq_restore(flags);
+
+    return now;
+}
+
+static struct clocksource jiffies_clocksource = {
+    .name = "jiffies",
+    .read = jiffies_read,
+    .mask = ~(uint64_t)0,
+    .mult = NSEC_PER_MSEC,
+    .shift = 0,
+    .rating = 1,
+};
+
+uint64_t timer_now_ms() {
+    return div_u64(ktime_get_ns(), NSEC_PER_MSEC);
+}
+
+static void wheel_link(struct timer **slot, struct timer *timer) {
+    timer->next = *slot;
+    timer->pprev = slot;
+    if (*slot != (void *)0) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+}
+
+//must be called with interrupts off
+static void wheel_insert(struct timer *timer) {
+    uint64_t expires = max(timer->expires, wheel_clk);
+    uint32_t level;
+
+    if (expires - wheel_clk > TIMER_MAX_DELTA) {
+        expires = wheel_clk + TIMER_MAX_DELTA;
+    }
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (expires - wheel_clk < (uint64_t)1 << ((level + 1) * TIMER_SLOT_BITS)) {
+            break;
+        }
+    }
+
+    uint32_t slot = (expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+    wheel_link(&wheel[level][slot], timer);
+    wheel_bitmap[level] |= (uint64_t)1 << slot;
+}
+
+//must be called with interrupts off
+static void wheel_unlink(struct timer *timer) {
+    struct timer **pprev = timer->pprev;
+
+    *pprev = timer->next;
+    if (timer->next != (void *)0) {
+        timer->next->pprev = pprev;
+    }
+    timer->next = (void *)0;
+    timer->pprev = (void *)0;
+
+    //was it the last one of a wheel slot: keep the bitmap in sync
+    uint32_t index = ((uint32_t)pprev - (uint32_t)&wheel[0][0]) / sizeof(struct timer *);
+    if (index < TIMER_LEVELS * TIMER_SLOTS && *pprev == (void *)0) {
+        wheel_bitmap[index / TIMER_SLOTS] &= ~((uint64_t)1 << (index % TIMER_SLOTS));
+    }
+}
+
+static void wheel_cascade(uint32_t level, uint32_t slot) {
+    struct timer *timer = wheel[level][slot];
+
+    wheel[level][slot] = (void *)0;
+    wheel_bitmap[level] &= ~((uint64_t)1 << slot);
+
+    while (timer != (void *)0) {
+        struct timer *next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+}
+
+//distance from slot 'from' to the next non empty slot of the level, -1 if none
+static int wheel_find(uint32_t level, uint32_t from) {
+    uint64_t bits = wheel_bitmap[level];
+
+    if (bits == 0) {
+        return (-1);
+    }
+
+    if (from != 0) {
+        bits = (bits >> from) | (bits << (TIMER_SLOTS - from));
+    }
+
+    return (uint32_t)bits != 0 ? __builtin_ctz((uint32_t)bits) : 32 + __builtin_ctz((uint32_t)(bits >> 32));
+}
+
+//earliest point the wheel needs to be looked at again, a cascade or an expiry
+static uint64_t wheel_next_expiry(void) {
+    uint64_t next = ~(uint64_t)0;
+
+    int distance = wheel_find(0, wheel_clk & TIMER_SLOT_MASK);
+    if (distance >= 0) {
+        next = wheel_clk + distance;
+    }
+
+    for (uint32_t level = 1; level < TIMER_LEVELS; level++) {
+        uint32_t shift = level * TIMER_SLOT_BITS;
+        uint64_t index = wheel_clk >> shift;
+
+        //the current slot cascades now if we are on its boundary, else a
+        //turn later: then look from the next one, the current one comes last
+        if ((wheel_clk & (((uint64_t)1 << shift) - 1)) == 0) {
+            distance = wheel_find(level, index & TIMER_SLOT_MASK);
+        } else {
+            distance = wheel_find(level, (index + 1) & TIMER_SLOT_MASK);
+            distance = distance < 0 ? distance : distance + 1;
+        }
+
+        if (distance < 0) {
+            continue;
+        }
+        next = min(next, (index + distance) << shift);
+    }
+
+    return next;
+}
+
+//must be called with interrupts off
+static void timer_program(uint64_t now) {
+    if (!tickless) {
+        return;
+    }
+
+    uint64_t next = wheel_next_expiry();
+    uint64_t delta = next > now ? next - now : 1;
+
+    delta = min(delta, clock_event->max_delta_ms);
+    next_event = now + delta;
+    clock_event->set_next(delta);
+}
+
+static void timer_work(void *ext __attribute__((unused))) {
+    unsigned int flags = irq_save();
+    uint64_t now = timer_now_ms();
+
+    while (wheel_clk <= now) {
+        uint32_t slot = wheel_clk & TIMER_SLOT_MASK;
+
+        if (slot == 0) {
+            for (uint32_t level = 1; level < TIMER_LEVELS; level++) {
+                uint32_t index = (wheel_clk >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+                wheel_cascade(level, index);
+                if (index != 0) {
+                    break;
+                }
+            }
+        }
+
+        //move the expired ones to a local list, a timer function may cancel the others
+        struct timer *expired = wheel[0][slot];
+        wheel[0][slot] = (void *)0;
+        wheel_bitmap[0] &= ~((uint64_t)1 << slot);
+        if (expired != (void *)0) {
+            expired->pprev = &expired;
+        }
+        wheel_clk++;
+
+        while (expired != (void *)0) {
+            struct timer *timer = expired;
+            wheel_unlink(timer);
+
+            irq_restore(flags);
+            timer->fnc(timer->ext);
+            flags = irq_save();
+        }
+
+        //skip the empty slots up to the next one in use or the next cascade
+        slot = wheel_clk & TIMER_SLOT_MASK;
+        if (slot != 0) {
+            int distance = wheel_find(0, slot);
+            uint64_t skip = distance >= 0 && slot + distance < TIMER_SLOTS ? (uint32_t)distance : TIMER_SLOTS - slot;
+            wheel_clk = min(wheel_clk + skip, now + 1);
+        }
+    }
+
+    timer_program(now);
+    irq_restore(flags);
+}
+
+static struct work_item timer_work_item = WORK_ITEM_INIT(timer_work, (void *)0);
+
+static int timer_interrupt(unsigned int intno __attribute__((unused)), void *ext __attribute__((unused))) {
+    if (!tickless) {
+        jiffies_ms += 1000 / TIMER_PERIODIC_HZ;
+    }
+
+    softirq_raise(SOFTIRQ_TIMER, &timer_work_item);
+    return (IRQ_HANDLED);
+}
+
+void timer_add(struct timer *timer, uint32_t ms) {
+    unsigned int flags = irq_save();
+    uint64_t now = timer_now_ms();
+
+    if (timer->pprev != (void *)0) {
+        wheel_unlink(timer);
+    }
+
+    timer->expires = now + ms;
+    wheel_insert(timer);
+
+    if (tickless && timer->expires < next_event) {
+        timer_program(now);
+    }
+
+    irq_restore(flags);
+}
+
+void timer_cancel(struct timer *timer) {
+    unsigned int flags = irq_save();
+
+    if (timer->pprev != (void *)0) {
+        wheel_unlink(timer);
+    }
+
+    irq_restore(flags);
+}
+
+int timer_pending(struct timer *timer) {
+    return timer->pprev != (void *)0;
+}
+
+struct sleeper {
+    volatile uint8_t done;
+    struct wait_queue queue;
+};
+
+static void sleep_wakeup(void *ext) {
+    struct sleeper *sleeper = (struct sleeper *)ext;
+
+    sleeper->done = 1;
+    wait_queue_wake(&sleeper->queue);
+}
+
+//a task sleeps, other contexts halt until the timer fires or busy wait
+//where no interrupt can wake them
+void sleep(unsigned int ms) {
+    struct sleeper sleeper = { 0, { (void *)0, (void *)0 } };
+    struct timer timer = TIMER_INIT(sleep_wakeup, (void *)&sleeper);
+    unsigned int flags = irq_save();
+    int can_block = clock_event != (void *)0 && sched_can_block();
+
+    if (!can_block && (clock_event == (void *)0 || (flags & EFLAGS_IF) == 0 || this_cpu_read(interrupt_nesting) != 0 || softirq_active())) {
+        irq_restore(flags);
+        pit_delay(ms);
+        return;
+    }
+
+    timer_add(&timer, ms);
+    while (!sleeper.done) {
+        if (can_block) {
+            wait_queue_sleep(&sleeper.queue);
+        } else {
+            cpu_idle_halt();
+        }
+    }
+
+    irq_restore(flags);
+}
+
+void timer_init() {
+    memset(wheel, 0, sizeof(wheel));
+    memset(wheel_bitmap, 0, sizeof(wheel_bitmap));
+    jiffies_ms = 0;
+
+    clock_event = &pit_clock_event;
+    if (apic_enabled) {
+        lapic_ticks_per_ms = lapic_timer_calibrate();
+        if (lapic_ticks_per_ms != 0) {
+            lapic_clock_event.max_delta_ms = 0xFFFFFFFF / lapic_ticks_per_ms;
+            clock_event = &lapic_clock_event;
+        }
+    }
+
+    if (register_interrupt(clock_event->vector, timer_interrupt, (void *)0) != 0) {
+        clock_event = (void *)0;
+        return;
+    }
+
+    clocksource_register(&jiffies_clocksource);
+    wheel_clk = timer_now_ms();
+
+    if (clocksource_current->flags & CLOCKSOURCE_CONTINUOUS) {
+        tickless = 1;
+        next_event = ~(uint64_t)0;
+        clock_event->set_next(clock_event->max_delta_ms);
+    } else {
+        clock_event->set_periodic(TIMER_PERIODIC_HZ);
+    }
+
+    kprintf("timer: %s, %s\n", clock_event->name, tickless ? "tickless" : "periodic");
+}
+
+#ifdef SELFTEST
+static struct timer *selftest_wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t selftest_bitmap[TIMER_LEVELS];
+
+//wheel_next_expiry on a wheel of its own: wheel_clk off a level 1
+//boundary, a timer a turn away in the current level 1 slot
+void timer_selftest() {
+    struct timer later = TIMER_INIT((void *)0, (void *)0);
+    struct timer sooner = TIMER_INIT((void *)0, (void *)0);
+    unsigned int flags = irq_save();
+    uint64_t clk = wheel_clk;
+
+    memcpy(selftest_wheel, wheel, sizeof(wheel));
+    memcpy(selftest_bitmap, wheel_bitmap, sizeof(wheel_bitmap));
+    memset(wheel, 0, sizeof(wheel));
+    memset(wheel_bitmap, 0, sizeof(wheel_bitmap));
+
+    wheel_clk = 3 * 4096 + 5 * 64 + 7;
+    later.expires = wheel_clk + 4090; //level 1, the current slot
+    wheel_insert(&later);
+    selftest_check("timer: next expiry a turn later", wheel_next_expiry() == (uint64_t)261 * 64);
+
+    sooner.expires = wheel_clk + 200; //level 1, 3 slots away
+    wheel_insert(&sooner);
+    selftest_check("timer: next expiry off a slot boundary", wheel_next_expiry() == (uint64_t)200 * 64);
+
+    memcpy(wheel, selftest_wheel, sizeof(wheel));
+    memcpy(wheel_bitmap, selftest_bitmap, sizeof(wheel_bitmap));
+    wheel_clk = clk;
+    irq_restore(flags);
+}
+#endif
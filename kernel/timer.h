@@ -0,0 +1,35 @@
+#ifndef __TIMER__
+#define __TIMER__
+
+#include <stdint.h>
+
+// Clock event devices raise the timer interrupt, the timer wheel keeps the
+// pending timers. Timer functions run from the timer softirq, with
+// interrupts enabled; times are in milliseconds.
+
+struct clock_event {
+    const char *name;
+    uint32_t vector;
+    uint32_t max_delta_ms; //longest one shot delay
+    void (*set_next)(uint32_t ms); //one shot, 0 if the device can't
+    void (*set_periodic)(uint32_t hz);
+};
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev; //0 when not pending
+    uint64_t expires;
+    void (*fnc)(void *);
+    void *ext;
+};
+
+#define TIMER_INIT(fnc, ext) { (void *)0, (void *)0, 0, (fnc), (ext) }
+
+void timer_init(void);
+uint64_t timer_now_ms(void);
+void timer_add(struct timer *timer, uint32_t ms);
+void timer_cancel(struct timer *timer);
+int timer_pending(struct timer *timer);
+void sleep(unsigned int ms);
+
+#endif
@@ -0,0 +1,477 @@
+#include <stdint.h>
+#include "stdlib.h"
+#include "pmm.h"
+#include "liballoc.h"
+#include "heap_profile.h"
+
+// Two-Level Segregated Fit allocator (Masmano et al.).
+// Free blocks are kept in fl x sl segregated lists, and two levels of
+// bitmaps tell which lists are non-empty, so finding a fitting block and
+// releasing one are both constant time. Memory comes from the same page
+// hooks as liballoc (liballoc_alloc/liballoc_free in liballoc_hook.c).
+
+#define TLSF_ALIGN_LOG2 3
+#define TLSF_ALIGN (1 << TLSF_ALIGN_LOG2)
+
+#define TLSF_SL_INDEX_COUNT_LOG2 4
+#define TLSF_SL_INDEX_COUNT (1 << TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_FL_INDEX_MAX 30
+#define TLSF_FL_INDEX_SHIFT (TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_FL_INDEX_COUNT (TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+#define TLSF_SMALL_BLOCK_SIZE (1 << TLSF_FL_INDEX_SHIFT)
+
+#define TLSF_BLOCK_FREE 0x1
+#define TLSF_BLOCK_PREV_FREE 0x2
+#define TLSF_BLOCK_FLAGS (TLSF_BLOCK_FREE | TLSF_BLOCK_PREV_FREE)
+
+#define TLSF_MIN_POOL_PAGES 16
+
+struct tlsf_block {
+    struct tlsf_block *prev_phys;
+    uint32_t size; //payload size, low bits hold the flags
+
+#ifdef HEAP_PROFILE
+    uint32_t site;
+    uint32_t requested;
+#endif
+
+    //only meaningfull while the block is free, overlap the payload otherwise
+    struct tlsf_block *next_free;
+    struct tlsf_block *prev_free;
+};
+
+struct tlsf_pool {
+    struct tlsf_pool *next;
+    uint32_t pages;
+};
+
+#define TLSF_BLOCK_OVERHEAD __builtin_offsetof(struct tlsf_block, next_free)
+#define TLSF_BLOCK_SIZE_MIN (sizeof(struct tlsf_block) - TLSF_BLOCK_OVERHEAD)
+#define TLSF_BLOCK_SIZE_MAX (1U << TLSF_FL_INDEX_MAX)
+
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[TLSF_FL_INDEX_COUNT];
+static struct tlsf_block *blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+static struct tlsf_pool *pools;
+
+static inline int tlsf_fls(uint32_t word) {
+    return word ? 31 - __builtin_clz(word) : -1;
+}
+
+static inline int tlsf_ffs(uint32_t word) {
+    return word ? __builtin_ctz(word) : -1;
+}
+
+static inline uint32_t block_size(const struct tlsf_block *block) {
+    return block->size & ~TLSF_BLOCK_FLAGS;
+}
+
+static inline void block_set_size(struct tlsf_block *block, uint32_t size) {
+    block->size = size | (block->size & TLSF_BLOCK_FLAGS);
+}
+
+static inline int block_is_free(const struct tlsf_block *block) {
+    return (block->size & TLSF_BLOCK_FREE) != 0;
+}
+
+static inline int block_is_prev_free(const struct tlsf_block *block) {
+    return (block->size & TLSF_BLOCK_PREV_FREE) != 0;
+}
+
+static inline void *block_to_ptr(const struct tlsf_block *block) {
+    return (void *)((uintptr_t)block + TLSF_BLOCK_OVERHEAD);
+}
+
+static inline struct tlsf_block *block_from_ptr(const void *ptr) {
+    return (struct tlsf_block *)((uintptr_t)ptr - TLSF_BLOCK_OVERHEAD);
+}
+
+static inline struct tlsf_block *block_next(const struct tlsf_block *block) {
+    return (struct tlsf_block *)((uintptr_t)block_to_ptr(block) + block_size(block));
+}
+
+//tell the next physical block whether we are free, and who we are
+static inline void block_link_next(struct tlsf_block *block) {
+    struct tlsf_block *next = block_next(block);
+
+    next->prev_phys = block;
+    if (block_is_free(block)) {
+        next->size |= TLSF_BLOCK_PREV_FREE;
+    } else {
+        next->size &= ~TLSF_BLOCK_PREV_FREE;
+    }
+}
+
+static inline uint32_t adjust_request_size(size_t size) {
+    uint32_t adjust = (size + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    return adjust < TLSF_BLOCK_SIZE_MIN ? TLSF_BLOCK_SIZE_MIN : adjust;
+}
+
+static inline void mapping_insert(uint32_t size, int *fli, int *sli) {
+    int fl, sl;
+
+    if (size < TLSF_SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT);
+    } else {
+        fl = tlsf_fls(size);
+        sl = (size >> (fl - TLSF_SL_INDEX_COUNT_LOG2)) ^ (1 << TLSF_SL_INDEX_COUNT_LOG2);
+        fl -= TLSF_FL_INDEX_SHIFT - 1;
+    }
+
+    *fli = fl;
+    *sli = sl;
+}
+
+//up to the next list boundary: any block of that list fits
+static inline uint32_t mapping_round(uint32_t size) {
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        size += (1 << (tlsf_fls(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+
+    return size;
+}
+
+//same as mapping_insert but rounds up so that any block of the list fits
+static inline void mapping_search(uint32_t size, int *fli, int *sli) {
+    mapping_insert(mapping_round(size), fli, sli);
+}
+
+static struct tlsf_block *search_suitable_block(int *fli, int *sli) {
+    int fl = *fli;
+    int sl = *sli;
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = fl_bitmap & (~0U << (fl + 1));
+        if (fl_map == 0) {
+            return (void *)0;
+        }
+
+        fl = tlsf_ffs(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+
+    sl = tlsf_ffs(sl_map);
+    *fli = fl;
+    *sli = sl;
+
+    return blocks[fl][sl];
+}
+
+static void remove_free_block(struct tlsf_block *block, int fl, int sl) {
+    struct tlsf_block *prev = block->prev_free;
+    struct tlsf_block *next = block->next_free;
+
+    if (next != (void *)0) {
+        next->prev_free = prev;
+    }
+
+    if (prev != (void *)0) {
+        prev->next_free = next;
+    }
+
+    if (blocks[fl][sl] == block) {
+        blocks[fl][sl] = next;
+        if (next == (void *)0) {
+            sl_bitmap[fl] &= ~(1U << sl);
+            if (sl_bitmap[fl] == 0) {
+                fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+}
+
+static void insert_free_block(struct tlsf_block *block, int fl, int sl) {
+    struct tlsf_block *current = blocks[fl][sl];
+
+    block->next_free = current;
+    block->prev_free = (void *)0;
+    if (current != (void *)0) {
+        current->prev_free = block;
+    }
+
+    blocks[fl][sl] = block;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+static inline void block_remove(struct tlsf_block *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free_block(block, fl, sl);
+}
+
+static inline void block_insert(struct tlsf_block *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    insert_free_block(block, fl, sl);
+}
+
+static struct tlsf_block *block_merge_next(struct tlsf_block *block);
+
+//cut block down to size, the tail becomes a new free block
+static void block_trim(struct tlsf_block *block, uint32_t size) {
+    if (block_size(block) < size + sizeof(struct tlsf_block)) {
+        return;
+    }
+
+    struct tlsf_block *remaining = (struct tlsf_block *)((uintptr_t)block_to_ptr(block) + size);
+    remaining->size = (block_size(block) - size - TLSF_BLOCK_OVERHEAD) | TLSF_BLOCK_FREE;
+    block_set_size(block, size);
+    block_link_next(block);
+    remaining = block_merge_next(remaining);
+    block_link_next(remaining);
+    block_insert(remaining);
+}
+
+static struct tlsf_block *block_merge_prev(struct tlsf_block *block) {
+    if (block_is_prev_free(block)) {
+        struct tlsf_block *prev = block->prev_phys;
+        block_remove(prev);
+        block_set_size(prev, block_size(prev) + TLSF_BLOCK_OVERHEAD + block_size(block));
+        block = prev;
+        block_link_next(block);
+    }
+
+    return block;
+}
+
+static struct tlsf_block *block_merge_next(struct tlsf_block *block) {
+    struct tlsf_block *next = block_next(block);
+
+    if (block_is_free(next)) {
+        block_remove(next);
+        block_set_size(block, block_size(block) + TLSF_BLOCK_OVERHEAD + block_size(next));
+        block_link_next(block);
+    }
+
+    return block;
+}
+
+//the only non constant time path: ask the hooks for more pages. The new
+//block has to land in the list mapping_search looks at, not below it
+static int tlsf_add_pool(uint32_t size) {
+    uint32_t usage = mapping_round(size) + sizeof(struct tlsf_pool) + 2 * TLSF_BLOCK_OVERHEAD;
+    uint32_t pages = (usage + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if (pages < TLSF_MIN_POOL_PAGES) {
+        pages = TLSF_MIN_POOL_PAGES;
+    }
+
+    struct tlsf_pool *pool = (struct tlsf_pool *)liballoc_alloc(pages);
+    if (pool == (void *)0) {
+        return 1;
+    }
+
+    pool->pages = pages;
+    pool->next = pools;
+    pools = pool;
+
+    //one big free block followed by a zero sized used sentinel
+    struct tlsf_block *block = (struct tlsf_block *)((uintptr_t)pool + sizeof(struct tlsf_pool));
+    block->prev_phys = (void *)0;
+    block->size = (pages * PAGE_SIZE - sizeof(struct tlsf_pool) - 2 * TLSF_BLOCK_OVERHEAD) | TLSF_BLOCK_FREE;
+
+    struct tlsf_block *sentinel = block_next(block);
+    sentinel->size = 0;
+    block_link_next(block);
+    block_insert(block);
+
+    return 0;
+}
+
+static inline struct tlsf_block *pool_first_block(struct tlsf_pool *pool) {
+    return (struct tlsf_block *)((uintptr_t)pool + sizeof(struct tlsf_pool));
+}
+
+static void *tlsf_malloc(size_t size, void *caller __attribute__((unused))) {
+    struct tlsf_block *block;
+    uint32_t adjust;
+    int fl, sl;
+
+    if (size == 0 || size > TLSF_BLOCK_SIZE_MAX / 2) {
+        return (void *)0;
+    }
+
+    liballoc_lock();
+
+    adjust = adjust_request_size(size);
+    mapping_search(adjust, &fl, &sl);
+    block = search_suitable_block(&fl, &sl);
+
+    if (block == (void *)0) {
+        if (tlsf_add_pool(adjust) != 0) {
+            liballoc_unlock();
+            return (void *)0;
+        }
+
+        mapping_search(adjust, &fl, &sl);
+        block = search_suitable_block(&fl, &sl);
+        if (block == (void *)0) {
+            liballoc_unlock();
+            return (void *)0;
+        }
+    }
+
+    remove_free_block(block, fl, sl);
+    block_trim(block, adjust);
+    block->size &= ~TLSF_BLOCK_FREE;
+    block_link_next(block);
+
+#ifdef HEAP_PROFILE
+    block->site = heap_profile_alloc(caller, size);
+    block->requested = size;
+#endif
+
+    liballoc_unlock();
+    return block_to_ptr(block);
+}
+
+void *malloc(size_t size) {
+    return tlsf_malloc(size, __builtin_return_address(0));
+}
+
+void free(void *ptr) {
+    struct tlsf_block *block;
+
+    if (ptr == (void *)0) {
+        return;
+    }
+
+    liballoc_lock();
+
+    block = block_from_ptr(ptr);
+    if (block_is_free(block)) {
+        //double free, ignore it like liballoc does with a bad magic
+        liballoc_unlock();
+        return;
+    }
+
+#ifdef HEAP_PROFILE
+    heap_profile_free(block->site, block->requested);
+#endif
+
+    block->size |= TLSF_BLOCK_FREE;
+    block = block_merge_prev(block);
+    block = block_merge_next(block);
+    block_link_next(block);
+    block_insert(block);
+
+    liballoc_unlock();
+}
+
+void *calloc(size_t nobj, size_t size) {
+    size_t real_size = nobj * size;
+    void *ptr;
+
+    if (size != 0 && real_size / size != nobj) {
+        return (void *)0;
+    }
+
+    ptr = tlsf_malloc(real_size, __builtin_return_address(0));
+    if (ptr != (void *)0) {
+        memset(ptr, 0, real_size);
+    }
+
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    struct tlsf_block *block;
+    uint32_t adjust;
+    void *new_ptr;
+
+    if (size == 0) {
+        free(ptr);
+        return (void *)0;
+    }
+
+    if (ptr == (void *)0) {
+        return tlsf_malloc(size, __builtin_return_address(0));
+    }
+
+    adjust = adjust_request_size(size);
+
+    liballoc_lock();
+    block = block_from_ptr(ptr);
+
+    //grow in place when the next block is free and big enough
+    struct tlsf_block *next = block_next(block);
+    if (adjust > block_size(block) && block_is_free(next) &&
+        block_size(block) + TLSF_BLOCK_OVERHEAD + block_size(next) >= adjust) {
+        block_merge_next(block);
+    }
+
+    if (adjust <= block_size(block)) {
+        block_trim(block, adjust);
+#ifdef HEAP_PROFILE
+        heap_profile_free(block->site, block->requested);
+        block->site = heap_profile_alloc(__builtin_return_address(0), size);
+        block->requested = size;
+#endif
+        liballoc_unlock();
+        return ptr;
+    }
+
+    uint32_t old_size = block_size(block);
+    liballoc_unlock();
+
+    new_ptr = tlsf_malloc(size, __builtin_return_address(0));
+    if (new_ptr != (void *)0) {
+        memcpy(new_ptr, ptr, min(old_size, size));
+        free(ptr);
+    }
+
+    return new_ptr;
+}
+
+int heap_trim(void) {
+    struct tlsf_pool **link;
+    struct tlsf_pool *pool;
+    int released = 0;
+
+    if (liballoc_lock() != 0) {
+        return 0;
+    }
+
+    //a pool is unused when its first block is free and runs up to the sentinel
+    link = &pools;
+    while ((pool = *link) != (void *)0) {
+        struct tlsf_block *block = pool_first_block(pool);
+
+        if (block_is_free(block) && block_size(block_next(block)) == 0) {
+            *link = pool->next;
+            block_remove(block);
+            released += pool->pages;
+            liballoc_free(pool, pool->pages);
+            continue;
+        }
+
+        link = &pool->next;
+    }
+
+    liballoc_unlock();
+    return released;
+}
+
+void heap_fragmentation(struct heap_frag_report *report) {
+    liballoc_lock();
+
+    for (int fl = 0; fl < TLSF_FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < TLSF_SL_INDEX_COUNT; sl++) {
+            for (struct tlsf_block *block = blocks[fl][sl]; block != (void *)0; block = block->next_free) {
+                uint32_t size = block_size(block);
+
+                report->free_lists[heap_size_class(size)]++;
+                report->free_blocks++;
+                report->free_bytes += size;
+                if (size > report->largest_free) {
+                    report->largest_free = size;
+                }
+            }
+        }
+    }
+
+    liballoc_unlock();
+}
@@ -0,0 +1,68 @@
+; application processor startup, copied to SMP_TRAMPOLINE_ADDR (smp.c)
+;
+; the processor starts in real mode at SMP_TRAMPOLINE_ADDR: load a flat gdt,
+; enable protection, then paging on the kernel page directory (the page is
+; identity mapped for the time of the startup) and jump to the higher half.
+; smp_init fills the cr3, stack and cpu fields before each startup ipi.
+
+%define SMP_TRAMPOLINE_ADDR 0x8000
+%define REL(label) (SMP_TRAMPOLINE_ADDR + (label) - smp_trampoline_start)
+
+extern smp_ap_entry
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_cr3
+global smp_trampoline_stack
+global smp_trampoline_cpu
+
+bits 16
+smp_trampoline_start:
+	cli
+	cld
+	xor ax, ax
+	mov ds, ax
+
+	lgdt [REL(trampoline_gdt_ptr)]
+
+	mov eax, cr0
+	and eax, 0x9FFFFFFF ; caches on, the ap comes out of reset with cd/nw set
+	or eax, 1
+	mov cr0, eax
+	jmp dword 0x08:REL(trampoline_protected)
+
+bits 32
+trampoline_protected:
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov ss, ax
+
+	mov eax, [REL(smp_trampoline_cr3)]
+	mov cr3, eax
+	mov eax, cr0
+	or eax, 0x80000000
+	mov cr0, eax
+
+	mov esp, [REL(smp_trampoline_stack)]
+	push dword [REL(smp_trampoline_cpu)]
+	push dword 0 ; no return
+	mov eax, smp_ap_entry
+	jmp eax
+
+align 8
+trampoline_gdt:
+	dq 0
+	dq 0x00CF9A000000FFFF ; code 0x08
+	dq 0x00CF92000000FFFF ; data 0x10
+trampoline_gdt_ptr:
+	dw 3 * 8 - 1
+	dd REL(trampoline_gdt)
+
+align 4
+smp_trampoline_cr3: dd 0
+smp_trampoline_stack: dd 0
+smp_trampoline_cpu: dd 0
+smp_trampoline_end:
@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include "tsc.h"
+#include "clocksource.h"
+#include "cpu.h"
+#include "pit.h"
+#include "stdlib.h"
+
+// The tsc frequency comes from the cpuid frequency leaves when the cpu has
+// them, else it is measured against the pit: channel 2 counts down a known
+// interval with its gate driven through port 0x61, no irq needed.
+//
+// Without the invariant bit the rate may change with power states, such a
+// tsc is still preferred but checked by the clocksource watchdog.
+
+#define TSC_CALIBRATE_MS 10
+
+#define CPUID_LEAF_TSC 0x15
+#define CPUID_LEAF_FREQUENCY 0x16
+#define CPUID_EXT_MAX_LEAF 0x80000000
+#define CPUID_EXT_POWER 0x80000007
+#define CPUID_EXT_POWER_EDX_INVARIANT_TSC (1 << 8)
+
+struct tsc_clock tsc_clock;
+
+static uint64_t tsc_read(void) {
+    return rdtsc();
+}
+
+struct clocksource tsc_clocksource = {
+    .name = "tsc",
+    .read = tsc_read,
+    .mask = ~(uint64_t)0,
+    .flags = CLOCKSOURCE_CONTINUOUS,
+};
+
+static uint32_t tsc_calibrate_pit(void) {
+    pit_gate_start(TSC_CALIBRATE_MS);
+    uint64_t start = rdtsc();
+    while (!pit_gate_done()) {}
+    uint64_t end = rdtsc();
+    pit_gate_stop();
+
+    return (uint32_t)div_u64(end - start, TSC_CALIBRATE_MS);
+}
+
+static uint32_t tsc_khz_from_cpuid(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    //tsc = crystal clock (ecx, in Hz) * ebx / eax
+    if (cpu_info.max_leaf >= CPUID_LEAF_TSC) {
+        cpuid(CPUID_LEAF_TSC, 0, &eax, &ebx, &ecx, &edx);
+        if (eax != 0 && ebx != 0 && ecx != 0) {
+            return div_u64(div_u64((uint64_t)ecx * ebx, eax), 1000);
+        }
+    }
+
+    //base frequency in MHz, the tsc runs at it on the cpus that lack the crystal value
+    if (cpu_info.max_leaf >= CPUID_LEAF_FREQUENCY) {
+        cpuid(CPUID_LEAF_FREQUENCY, 0, &eax, &ebx, &ecx, &edx);
+        if ((eax & 0xFFFF) != 0) {
+            return (eax & 0xFFFF) * 1000;
+        }
+    }
+
+    return (0);
+}
+
+static int tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(CPUID_EXT_MAX_LEAF, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_EXT_POWER) {
+        return (0);
+    }
+
+    cpuid(CPUID_EXT_POWER, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_EXT_POWER_EDX_INVARIANT_TSC) != 0;
+}
+
+void tsc_init() {
+    memset(&tsc_clock, 0, sizeof(tsc_clock));
+
+    if (!cpu_has(CPU_FEATURE_TSC)) {
+        kprintf("tsc: not available\n");
+        return;
+    }
+
+    uint32_t khz = tsc_khz_from_cpuid();
+    if (khz != 0) {
+        tsc_clock.flags |= TSC_FROM_CPUID;
+    } else {
+        khz = tsc_calibrate_pit();
+    }
+
+    if (khz == 0) {
+        kprintf("tsc: calibration failed\n");
+        return;
+    }
+
+    tsc_clock.khz = khz;
+    clocks_calc_mult_shift(&tsc_clock.mult, &tsc_clock.shift, khz, NSEC_PER_MSEC);
+
+    if (tsc_invariant()) {
+        tsc_clock.flags |= TSC_INVARIANT;
+        tsc_clocksource.rating = 300;
+    } else {
+        tsc_clocksource.rating = 250;
+        tsc_clocksource.flags |= CLOCKSOURCE_VERIFY;
+    }
+    tsc_clocksource.mult = tsc_clock.mult;
+    tsc_clocksource.shift = tsc_clock.shift;
+    clocksource_register(&tsc_clocksource);
+
+    kprintf("tsc: %d kHz (%s, mult %d, shift %d)%s\n", tsc_clock.khz, (tsc_clock.flags & TSC_FROM_CPUID) ? "cpuid" : "pit",
+            tsc_clock.mult, tsc_clock.shift, (tsc_clock.flags & TSC_INVARIANT) ? " invariant" : "");
+}
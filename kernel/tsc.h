@@ -0,0 +1,23 @@
+#ifndef __TSC__
+#define __TSC__
+
+#include <stdint.h>
+
+#define TSC_INVARIANT 0x1 //constant rate in all p/c states
+#define TSC_FROM_CPUID 0x2 //frequency read from cpuid, not measured
+
+struct tsc_clock {
+    uint32_t khz; //0 when there is no usable tsc
+    uint32_t mult; //ns = (cycles * mult) >> shift
+    uint32_t shift;
+    uint32_t flags;
+};
+
+struct clocksource;
+
+extern struct tsc_clock tsc_clock;
+extern struct clocksource tsc_clocksource;
+
+void tsc_init(void);
+
+#endif
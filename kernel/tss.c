@@ -1,5 +1,19 @@
-extern void gdt_set_gate(int num, unsigned int base, unsigned int limit, unsigned char access, unsigned char gran);
-extern void *memset(void* dst, int c, unsigned long size);
+#include <stdint.h>
+
+extern void gdt_set_gate(uint32_t cpu, int num, unsigned int base, unsigned int limit, unsigned char access, unsigned char gran);
+extern void sysenter_entry(void);
+extern void tss_flush(unsigned int selector);
+
+#include "cpu.h"
+#include "smp.h"
+#include "stdlib.h"
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define TSS_GDT_GATE 5 //in each cpu's gdt
+#define TSS_SELECTOR 0x2b
 
 struct tss_entry {
 	unsigned int prev_tss; // The previous TSS - with hardware task switching these form a kind of backward linked list.
@@ -32,23 +46,45 @@ struct tss_entry {
 	unsigned short iomap_base;
 } __attribute__((packed));
 
-struct tss_entry tss;
+//one per cpu, behind the same selector of each cpu's gdt
+struct tss_entry tss[SMP_MAX_CPUS];
+
+static void write_tss(uint32_t cpu, unsigned short ss0, unsigned int esp0) {
+    struct tss_entry *entry = &tss[cpu];
 
-void write_tss(unsigned short ss0, unsigned int esp0) {
-    gdt_set_gate(5, (unsigned int)&tss, (unsigned int)&tss + sizeof(struct tss_entry), 0xE9, 0x00);
+    gdt_set_gate(cpu, TSS_GDT_GATE, (unsigned int)entry, (unsigned int)entry + sizeof(struct tss_entry), 0xE9, 0x00);
 
-    memset(&tss, 0, sizeof(struct tss_entry));
-    tss.ss0 = ss0;
-    tss.esp0 = esp0;
-	tss.cs = 0x0b;
-    tss.ss = 0x13;
-    tss.ds = 0x13;
-    tss.es = 0x13;
-    tss.fs = 0x13;
-    tss.gs = 0x13;
+    memset(entry, 0, sizeof(struct tss_entry));
+    entry->ss0 = ss0;
+    entry->esp0 = esp0;
+	entry->cs = 0x0b;
+    entry->ss = 0x13;
+    entry->ds = 0x13;
+    entry->es = 0x13;
+    entry->fs = 0x13;
+    entry->gs = 0x13;
 }
 
 
 void update_kernel_stack(void *stack) {
-	tss.esp0 = (unsigned int)stack;
-}
\ No newline at end of file
+	tss[this_cpu_read(index)].esp0 = (unsigned int)stack;
+}
+
+//sysenter doesn't look at the tss, so the stack msr points right after
+//tss.esp0 and the entry stub loads esp from there (see sysenter.asm)
+static void setup_sysenter(uint32_t cpu) {
+    if (!cpu_has(CPU_FEATURE_SEP)) {
+        return;
+    }
+
+    wrmsr(MSR_SYSENTER_CS, 0x08);
+    wrmsr(MSR_SYSENTER_ESP, (unsigned int)&tss[cpu].ss0);
+    wrmsr(MSR_SYSENTER_EIP, (unsigned int)&sysenter_entry);
+}
+
+//on the cpu itself, after gdt_setup_cpu
+void tss_setup_cpu(uint32_t cpu, uint32_t esp0) {
+    write_tss(cpu, 0x10, esp0);
+    tss_flush(TSS_SELECTOR);
+    setup_sysenter(cpu);
+}
@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include "vdso.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "tsc.h"
+#include "clocksource.h"
+#include "rtc.h"
+#include "cpu.h"
+#include "stdlib.h"
+#include "timer.h"
+
+// The kernel writes through its own mapping of the page, userspace only
+// gets a read only one at VDSO_USER_ADDR.
+
+#define VDSO_UPDATE_MS 1000
+
+static uint8_t vdso_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+struct vdso_data *vdso_data = (struct vdso_data *)vdso_page;
+
+static inline void vdso_write_begin(void) {
+    vdso_data->seq++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void vdso_write_end(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    vdso_data->seq++;
+}
+
+void vdso_init() {
+    memset(vdso_page, 0, PAGE_SIZE);
+
+    vdso_data->page_size = PAGE_SIZE;
+    vdso_data->cpu_count = 1;
+    //the rtc gives now, back it off to monotonic 0 so realtime = wall_boot_sec + monotonic
+    vdso_data->wall_boot_sec = rtc_read_epoch() - div_u64(ktime_get_ns(), NSEC_PER_SEC);
+
+    if (clocksource_current == &tsc_clocksource) {
+        vdso_data->flags |= VDSO_TSC_STABLE;
+        vdso_data->tsc_khz = tsc_clock.khz;
+        vdso_data->tsc_mult = tsc_clock.mult;
+        vdso_data->tsc_shift = tsc_clock.shift;
+        vdso_data->tsc_base = rdtsc();
+        vdso_data->monotonic_base_ns = ktime_get_ns();
+    }
+
+    if (vmm_map_phys((void *)VDSO_USER_ADDR, get_physaddr((virtaddr_t)vdso_page), PAGE_SIZE, VM_MAP_USER) != (void *)VDSO_USER_ADDR) {
+        kprintf("vdso: could not map the page at 0x%8h\n", VDSO_USER_ADDR);
+    }
+}
+
+//fold the elapsed time into the base, so readers multiply small deltas.
+//userspace stops using the tsc once the watchdog has dropped it
+void vdso_update() {
+    if ((vdso_data->flags & VDSO_TSC_STABLE) == 0) {
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t ns = ktime_get_ns();
+
+    vdso_write_begin();
+    if (clocksource_current != &tsc_clocksource) {
+        vdso_data->flags &= ~VDSO_TSC_STABLE;
+    }
+    vdso_data->tsc_base = now;
+    vdso_data->monotonic_base_ns = ns;
+    vdso_write_end();
+}
+
+static void vdso_timer_fnc(void *ext);
+static struct timer vdso_timer = TIMER_INIT(vdso_timer_fnc, (void *)0);
+
+static void vdso_timer_fnc(void *ext __attribute__((unused))) {
+    vdso_update();
+    timer_add(&vdso_timer, VDSO_UPDATE_MS);
+}
+
+//keep the tsc deltas readers multiply small
+void vdso_timer_start() {
+    timer_add(&vdso_timer, VDSO_UPDATE_MS);
+}
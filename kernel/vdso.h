@@ -0,0 +1,32 @@
+#ifndef __VDSO__
+#define __VDSO__
+
+#include <stdint.h>
+
+// Page shared read only with userspace at a fixed address (same layout in
+// userspace/time.h). Readers retry while seq is odd or changed under them.
+
+#define VDSO_USER_ADDR 0xBFFF0000
+
+#define VDSO_TSC_STABLE 0x1 //the tsc fields can be used
+
+struct vdso_data {
+    volatile uint32_t seq;
+    uint32_t flags;
+    uint32_t tsc_mult; //ns = (cycles * mult) >> shift
+    uint32_t tsc_shift;
+    uint64_t tsc_base; //tsc when the clock was last updated
+    uint64_t monotonic_base_ns; //monotonic time at tsc_base
+    uint64_t wall_boot_sec; //unix time at monotonic 0
+    uint32_t tsc_khz;
+    uint32_t cpu_count;
+    uint32_t page_size;
+};
+
+extern struct vdso_data *vdso_data;
+
+void vdso_init(void);
+void vdso_update(void);
+void vdso_timer_start(void);
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include "vga.h"
+#include "io.h"
+#include "stdlib.h"
+
+// Text console. Characters go to a shadow of the screen in ram, and only
+// the lines touched since the last flush are copied to video memory.
+// Scrolling moves the crtc start address down the 32KB of text memory
+// instead of copying the screen; the visible lines are only rewritten at
+// the top of it once the window reaches the end.
+
+#define ROW 25
+#define COL 80
+
+#define BIOS_VIDEO_PTR 0x000b8000
+#define KERNAL_MAP_BASE 0xc0000000
+#define VGA_MEMORY_SIZE 0x8000
+#define VGA_LINES (VGA_MEMORY_SIZE / (COL * 2))
+
+#define CRTC_ADDR 0x3D4
+#define CRTC_DATA 0x3D5
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW 0x0D
+#define CRTC_CURSOR_HIGH 0x0E
+#define CRTC_CURSOR_LOW 0x0F
+
+#define WHITE_ON_BLACK 0x07
+#define BLANK ((WHITE_ON_BLACK << 8) | ' ')
+
+static uint16_t *vidptr = (uint16_t *)(BIOS_VIDEO_PTR | KERNAL_MAP_BASE);
+
+//shadow lines are a ring, screen row r is shadow[(top + r) % ROW]
+static uint16_t shadow[ROW][COL];
+static uint32_t top = 0;
+static uint32_t xpos = 0;
+static uint32_t ypos = 0;
+
+static uint32_t dirty = 0; //one bit per screen row
+static uint32_t start_line = 0; //first text memory line shown
+static uint32_t shown_start_line = 0;
+
+static void crtc_write(uint8_t reg, uint16_t value) {
+    outb(CRTC_ADDR, reg);
+    outb(CRTC_DATA, value >> 8);
+    outb(CRTC_ADDR, reg + 1);
+    outb(CRTC_DATA, value & 0xFF);
+}
+
+static void vga_blank_line(uint16_t *line) {
+    for (uint32_t i = 0; i < COL; i++) {
+        line[i] = BLANK;
+    }
+}
+
+void vga_init() {
+    for (uint32_t r = 0; r < ROW; r++) {
+        vga_blank_line(shadow[r]);
+    }
+
+    top = 0;
+    xpos = 0;
+    ypos = 0;
+    start_line = 0;
+    shown_start_line = 1; //force the crtc update
+    dirty = (1 << ROW) - 1;
+    vga_flush();
+}
+
+static void vga_scroll(void) {
+    vga_blank_line(shadow[top]);
+    top = (top + 1) % ROW;
+
+    if (start_line + ROW < VGA_LINES) {
+        start_line++;
+        //screen rows moved up by one, so did the pending ones
+        dirty = (dirty >> 1) | (1u << (ROW - 1));
+    } else {
+        //end of text memory, back to the top with the whole screen
+        start_line = 0;
+        dirty = (1 << ROW) - 1;
+    }
+}
+
+void vga_put(char c) {
+    if (c == '\n') {
+        ++ypos;
+    }
+
+    if (c == '\n' || c == '\r') {
+        xpos = 0;
+    } else {
+        if (xpos > COL - 1) {
+            ++ypos;
+            xpos = 0;
+        }
+    }
+
+    if (ypos > ROW - 1) {
+        vga_scroll();
+        --ypos;
+    }
+
+    if (c == '\n' || c == '\r') {
+        return;
+    }
+
+    shadow[(top + ypos) % ROW][xpos] = (WHITE_ON_BLACK << 8) | (uint8_t)c;
+    dirty |= 1 << ypos;
+    ++xpos;
+}
+
+void vga_flush() {
+    for (uint32_t r = 0; dirty != 0; r++) {
+        if (dirty & (1 << r)) {
+            memcpy(vidptr + (start_line + r) * COL, shadow[(top + r) % ROW], COL * 2);
+            dirty &= ~(1 << r);
+        }
+    }
+
+    if (start_line != shown_start_line) {
+        crtc_write(CRTC_START_HIGH, start_line * COL);
+        shown_start_line = start_line;
+    }
+
+    crtc_write(CRTC_CURSOR_HIGH, (start_line + ypos) * COL + xpos);
+}
+
+void vga_write(const char *buffer, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        vga_put(buffer[i]);
+    }
+
+    vga_flush();
+}
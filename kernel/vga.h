@@ -0,0 +1,11 @@
+#ifndef __VGA__
+#define __VGA__
+
+#include <stdint.h>
+
+void vga_init(void);
+void vga_put(char c);
+void vga_write(const char *buffer, uint32_t size);
+void vga_flush(void);
+
+#endif
@@ -5,6 +5,9 @@
 #include "pmm.h"
 #include "bdev.h"
 #include "liballoc.h"
+#include "interrupt.h"
+#include "task.h"
+#include "smp.h"
 
 #define VIRTQ_DESC_F_NEXT 1
 #define VIRTQ_DESC_F_WRITE 2
@@ -45,8 +48,19 @@ struct virtio_blk {
     struct virtq queue;
     uint16_t queue_size;
     uint16_t last_seen;
+    struct pci_msix msix;
+    int vector; //-1 when polling
+    volatile uint32_t interrupts;
+    uint8_t busy; //one request at a time, it uses descriptors 0 to 2
+    struct wait_queue free; //tasks waiting for busy to clear
+    struct wait_queue done; //the task waiting for the used ring
 };
 
+//legacy interface registers only there once msi-x is on
+#define VIRTIO_MSI_CONFIG_VECTOR 0x14
+#define VIRTIO_MSI_QUEUE_VECTOR 0x16
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
 struct virtio_blk_req_header {
     uint32_t type;
     uint32_t reserved;
@@ -59,10 +73,24 @@ static inline uint32_t virtq_size(uint32_t queue_size) {
 }
 
 static int virtio_blk_read(void *bdev, uint32_t numsect, uint32_t lba, void *edi) {
-    struct virtio_blk_req_header header;
+    struct virtio_blk_req_header header __attribute__((aligned(16))); //not across a page, the device gets one address
     struct virtio_blk *blk = (struct virtio_blk *)bdev;
     uint8_t status;
 
+    //tasks sleep while the device works, the other contexts (boot, interrupted
+    //code) keep halting until the interrupt like before
+    unsigned int flags = irq_save();
+    int can_block = sched_can_block() && blk->vector >= 0;
+
+    while (blk->busy) {
+        if (can_block) {
+            wait_queue_sleep(&blk->free);
+        } else {
+            cpu_idle_halt();
+        }
+    }
+    blk->busy = 1;
+
     header.type = 0; //Read op
     header.sector = lba;
     mfence();
@@ -89,27 +117,87 @@ static int virtio_blk_read(void *bdev, uint32_t numsect, uint32_t lba, void *edi
     //device notification
     outb(blk->base + 0x10, 0);
 
-    // wait for result
+    // wait for result: sleep until the queue interrupt when we have one.
+    // interrupts are off since the check, sti;hlt can't miss it either (the
+    // interrupt is held until after the hlt)
     for(;;) {
         mfence();
         if (blk->queue.used->index != blk->last_seen) {
             blk->last_seen = (blk->last_seen + 1) % blk->queue_size;
             break;
         }
+
+        if (can_block) {
+            wait_queue_sleep(&blk->done);
+        } else if (blk->vector >= 0) {
+            cpu_idle_halt();
+        }
     }
 
+    blk->busy = 0;
+    wait_queue_wake(&blk->free);
+    irq_restore(flags);
+
     //kprintf("read finished\n");
 
     return status;
 }
 
+static int virtio_blk_interrupt(unsigned int interrupt __attribute__((unused)), void *ext) {
+    //msi-x: nothing to acknowledge, no isr status to read. the waiter checks the used ring
+    struct virtio_blk *device = (struct virtio_blk *)ext;
+
+    device->interrupts++;
+    wait_queue_wake(&device->done);
+    return (IRQ_HANDLED); //msi vectors are never shared
+}
+
+//one msi-x vector for queue 0, the config change one is left unused
+static void virtio_blk_setup_msix(struct virtio_blk *device, uint8_t bus, uint8_t slot, uint8_t fonc) {
+    device->vector = -1;
+
+    if (pci_enable_msix(bus, slot, fonc, &device->msix) != 0) {
+        kprintf("virtio_blk_init: no msi-x, polling\n");
+        return;
+    }
+
+    int vector = irq_alloc_vector(virtio_blk_interrupt, device);
+    if (vector < 0) {
+        return;
+    }
+
+    if (pci_msix_set_vector(&device->msix, 0, vector) != 0) {
+        goto fail;
+    }
+
+    outw(device->base + VIRTIO_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+    outw(device->base + 0x0e, 0); //select queue 0
+    outw(device->base + VIRTIO_MSI_QUEUE_VECTOR, 0);
+    if (inw(device->base + VIRTIO_MSI_QUEUE_VECTOR) == VIRTIO_MSI_NO_VECTOR) {
+        kprintf("virtio_blk_init: device refused the queue vector\n");
+        goto fail;
+    }
+
+    device->vector = vector;
+    kprintf("virtio_blk_init: queue 0 on vector 0x%2h\n", vector);
+    return;
+
+fail:
+    //polling then, the vector goes back for the next probe
+    unregister_interrupt(vector, virtio_blk_interrupt, device);
+}
+
 struct bdev_operation virtio_blk_ops = {
     .read = virtio_blk_read,
 };
 
-void virtio_blk_init(struct pci_header *head, uint8_t bus __attribute__((unused)), uint8_t slot __attribute__((unused)), uint8_t fonc __attribute__((unused))) {
+void virtio_blk_init(struct pci_header *head, uint8_t bus, uint8_t slot, uint8_t fonc) {
     kprintf("virtio_blk_init: bar0: 0x%8h\n", head->specific.type0.bar0);
     struct virtio_blk *device = (struct virtio_blk *)malloc(sizeof(struct virtio_blk));
+    device->interrupts = 0;
+    device->busy = 0;
+    device->free.head = device->free.tail = (void *)0;
+    device->done.head = device->done.tail = (void *)0;
 
     device->base = head->specific.type0.bar0 & 0xffffc;
 
@@ -126,12 +214,13 @@ void virtio_blk_init(struct pci_header *head, uint8_t bus __attribute__((unused)
     uint32_t totan_queue_size = ((virtq_size(device->queue_size) / 4096) + 1) * 4096; //to have full page size
 
     device->queue.desc = (struct virtq_desc *)add_vm_entry(NULL, totan_queue_size, VM_MAP_ANONYMOUS | VM_MAP_WRITE | VM_MAP_KERNEL, (void *)0, 0, 0);
-    memset_unsafe(device->queue.desc, 0, totan_queue_size);
+    memset(device->queue.desc, 0, totan_queue_size);
     device->queue.avail = (struct virtq_avail *)((uint32_t)device->queue.desc + desc_size);
     device->queue.used = (struct virtq_used *)(((((uint32_t)device->queue.avail + avail_size) / 4096) + 1) * 4096);
 
     outw(device->base + 0x0e, 0); //select queue 0
     outl(device->base + 0x08, get_physaddr(device->queue.desc) / 4096); //set queue adresse
+    virtio_blk_setup_msix(device, bus, slot, fonc);
     outb(device->base + 0x12, inb(device->base + 0x12) | 4); //driver_ok
 
     kprintf("virtio_blk_init: device status: 0x%2h\n", inb(device->base + 0x12));
@@ -6,6 +6,9 @@
 #include "interrupt.h"
 #include "stdlib.h"
 #include "fat.h"
+#include "liballoc.h"
+#include "klog.h"
+#include "smp.h"
 
 #define FIRST_12BITS_MASK 0xFFF
 
@@ -49,7 +52,7 @@ extern void PAGE_DIRECTORY(void);
 extern void PAGE_TABLE(void);
 unsigned int * kpage_directory = (unsigned int *)&PAGE_DIRECTORY;
 
-static void page_fault_interrupt_handler(unsigned int interrupt, void *ext);
+static int page_fault_interrupt_handler(unsigned int interrupt, void *ext);
 static int map_change_permission(virtaddr_t virtaddr, unsigned int flags);
 
 physaddr_t get_physaddr(virtaddr_t virtaddr) {
@@ -101,7 +104,7 @@ uint16_t get_flags(virtaddr_t virtaddr) {
 }
 
 int map_page(physaddr_t physadd, virtaddr_t virtaddr, unsigned int flags) {
-    kprintf("map_page: physadd: 0x%8h; virtaddr: 0x%8h; flags: 0x%8h\n", physadd, virtaddr, flags);
+    klog_debug("map_page: physadd: 0x%8h; virtaddr: 0x%8h; flags: 0x%8h\n", physadd, virtaddr, flags);
 
     unsigned int pdindex = VM_VITRADDR_TO_PDINDEX(virtaddr);
     unsigned int ptindex = VM_VITRADDR_TO_PTINDEX(virtaddr);
@@ -111,9 +114,9 @@ int map_page(physaddr_t physadd, virtaddr_t virtaddr, unsigned int flags) {
     if ((pdentry & 0x00000001) == 0) {
         //alloc page
         physaddr_t pagetable_physmap = bitmap_find_free_page();
-        kprintf("pa: 0x%8h\n", pagetable_physmap);
+        klog_debug("pa: 0x%8h\n", pagetable_physmap);
         if (pagetable_physmap == 0) {
-            kprintf("ERROR: could not get page\n");
+            klog_error("ERROR: could not get page\n");
             return 1;
         }
 
@@ -124,12 +127,12 @@ int map_page(physaddr_t physadd, virtaddr_t virtaddr, unsigned int flags) {
         kpage_directory[pdindex] = (pagetable_physmap & ~FIRST_12BITS_MASK) | VM_PAGE_READ_WRITE | (flags & VM_PAGE_USER_ACCESS) | VM_PAGE_PRESENT; //if map if showed with user access flag set, page direcotry should also have it to allow user
         
         //init page
-        memset(pagetable, 0, PAGE_SIZE);
+        zero_page(pagetable);
     }
 
     //kprintf("pt: 0x%8h; ptindex: %1d\n", pt, ptindex);
     if ((pagetable[ptindex] & 0x00000001) != 0) {
-        kprintf("ERROR: pte is present; map not free to use !\n");
+        klog_error("ERROR: pte is present; map not free to use !\n");
         return 2;
     }
 
@@ -139,7 +142,7 @@ int map_page(physaddr_t physadd, virtaddr_t virtaddr, unsigned int flags) {
 }
 
 static int map_change_permission(virtaddr_t virtaddr, unsigned int flags) {
-    kprintf("map_change_permission: virtaddr: 0x%8h; flags: 0x%8h\n", virtaddr, flags);
+    klog_debug("map_change_permission: virtaddr: 0x%8h; flags: 0x%8h\n", virtaddr, flags);
 
     unsigned int pdindex = VM_VITRADDR_TO_PDINDEX(virtaddr);
     unsigned int ptindex = VM_VITRADDR_TO_PTINDEX(virtaddr);
@@ -147,16 +150,18 @@ static int map_change_permission(virtaddr_t virtaddr, unsigned int flags) {
     unsigned int *pagetable = VM_PDINDEX_TO_PTR(pdindex);
 
     if ((pdentry & 0x00000001) == 0) {
-        kprintf("ERROR: map_change_permission: addr not mapped");
+        klog_error("ERROR: map_change_permission: addr not mapped\n");
         return (0);
     }
 
     if ((pagetable[ptindex] & 0x00000001) == 0) {
-        kprintf("ERROR: map_change_permission: addr not mapped 2");
+        klog_error("ERROR: map_change_permission: addr not mapped 2\n");
         return 2;
     }
 
     pagetable[ptindex] = (pagetable[ptindex] & ~FIRST_12BITS_MASK) | (flags & FIRST_12BITS_MASK) | VM_PAGE_PRESENT;
+    //the fault exit reloads cr3 here, the other cpus may still have the old rights
+    smp_tlb_shootdown(virtaddr & ~FIRST_12BITS_MASK, 1);
 
     return (0);
 }
@@ -167,9 +172,11 @@ void unmap_page(virtaddr_t virtaddr) {
     unsigned int ptindex = VM_VITRADDR_TO_PTINDEX(virtaddr);
     unsigned int *pagetable = VM_PDINDEX_TO_PTR(pdindex);
 
-    kprintf("map_page: virtaddr: 0x%8h; pdindex: 0x%8h; ptindex: 0x%8h; pt: 0x%8h\n", virtaddr, pdindex, ptindex, pagetable);
+    klog_debug("unmap_page: virtaddr: 0x%8h; pdindex: 0x%8h; ptindex: 0x%8h; pt: 0x%8h\n", virtaddr, pdindex, ptindex, pagetable);
 
     pagetable[ptindex] = 0;
+    flush_tlb_single((unsigned int)virtaddr);
+    smp_tlb_shootdown(virtaddr & ~FIRST_12BITS_MASK, 1);
 
     int index;
     for (index = 0; index < PAGE_LEN; index++) {
@@ -191,7 +198,7 @@ void vmm_init() {
 
     unsigned int pagetable_physmap = bitmap_find_free_page();
     if (pagetable_physmap == 0) {
-        kprintf("ERROR: vmm_init: could not get page\n");
+        klog_error("ERROR: vmm_init: could not get page\n");
         return;
     }
 
@@ -216,8 +223,6 @@ void vmm_init() {
     vm_map[0].base = (void *)0xffffffff;
     vm_map_size = 1;
     register_interrupt(0xE, page_fault_interrupt_handler, 0);
-
-    __stdlib_unsafe = 0;
 }
 
 static int is_hint_allowed(uintptr_t hint, size_t size, int flags) {
@@ -288,9 +293,7 @@ check_with_hint:
         if (vm_map[index - 1].base + vm_map[index - 1].size <= hint && vm_map[index].base > hint + size) {
 fit_with_hint:
             //it fit here with the hint
-            for (uint32_t j = vm_map_size; j > index; j--) {
-                memcpy(&vm_map[j], &vm_map[j-1], sizeof(struct vm_entry));
-            }
+            memmove(&vm_map[index + 1], &vm_map[index], sizeof(struct vm_entry) * (vm_map_size - index));
 
             vm_map[index].base = hint;
             vm_map[index].size = size;
@@ -326,7 +329,6 @@ fit_with_hint:
 
 void rm_vm_entry(void *base) {
     struct vm_entry *vmem = (struct vm_entry *)bsearch_s(base, vm_map, vm_map_size, sizeof(struct vm_entry), vm_entry_cmp, (void *)0);
-    uint32_t index = (vm_map - vmem) / sizeof(struct vm_entry);
     if (vmem == (void *)0) {
         return;
     }
@@ -335,11 +337,16 @@ void rm_vm_entry(void *base) {
         return;
     }
 
-    //for every page, check physical address and mark as free
+    uint32_t index = vmem - vm_map;
+
+    //for every page backed by a frame: drop the pte (and the tlb entry) then give the frame back
     for(virtaddr_t addr = vmem->base; addr < vmem->base + vmem->size; addr += PAGE_SIZE) {
         physaddr_t phys = get_physaddr(addr);
-        if (phys != 0) {
-            bitmap_find_free_page(phys);
+        if (get_flags(addr) & VM_PAGE_PRESENT) { //frame 0 can be mapped with VM_MAP_PHYS
+            unmap_page(addr);
+            if ((vmem->flags & VM_MAP_PHYS) == 0) {
+                bitmap_mark_as_free(phys & ~FIRST_12BITS_MASK);
+            }
         }
     }
 
@@ -347,12 +354,50 @@ void rm_vm_entry(void *base) {
     if (vmem->base == 0) {
         vmem->size = 0;
     } else {
-        memcpy(&vm_map[index], &vm_map[index + 1], sizeof(struct vm_entry) * (1023 - index));
+        memmove(&vm_map[index], &vm_map[index + 1], sizeof(struct vm_entry) * (vm_map_size - index - 1));
         vm_map_size--;
     }
 }
 
-static void page_fault_interrupt_handler(unsigned int interrupt __attribute__((unused)), void *ext __attribute__((unused))) {
+//map existing frames (kernel pages shared with userspace, device memory), eagerly.
+//returns the address of phys itself, which may be inside the first page
+void *vmm_map_phys(void *hint, physaddr_t phys, uint32_t size, uint32_t flags) {
+    unsigned int pte_flags = 0;
+    uint32_t page_offset = phys & FIRST_12BITS_MASK;
+
+    size = (size + page_offset + PAGE_SIZE - 1) & ~FIRST_12BITS_MASK;
+    phys &= ~FIRST_12BITS_MASK;
+
+    void *base = add_vm_entry(hint, size, (flags & ~(VM_MAP_ANONYMOUS | VM_MAP_FILE)) | VM_MAP_PHYS, (void *)0, 0, 0);
+    if (base == (void *)0) {
+        return (void *)0;
+    }
+
+    if (flags & VM_MAP_WRITE) {
+        pte_flags |= VM_PAGE_READ_WRITE;
+    }
+    if (flags & VM_MAP_USER) {
+        pte_flags |= VM_PAGE_USER_ACCESS;
+    }
+    if (flags & VM_MAP_NOCACHE) {
+        pte_flags |= VM_PAGE_CACHE_DISABLE | VM_PAGE_WRITE_THROUGH;
+    }
+
+    for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        if (map_page(phys + offset, (virtaddr_t)(base + offset), pte_flags) != 0) {
+            rm_vm_entry(base);
+            return (void *)0;
+        }
+    }
+
+    return base + page_offset;
+}
+
+void vmm_unmap_phys(void *addr) {
+    rm_vm_entry((void *)((uint32_t)addr & ~FIRST_12BITS_MASK));
+}
+
+static int page_fault_interrupt_handler(unsigned int interrupt __attribute__((unused)), void *ext __attribute__((unused))) {
     virtaddr_t faulty_address;
     struct vm_entry *vmem;
     uint8_t flags;
@@ -373,19 +418,30 @@ static void page_fault_interrupt_handler(unsigned int interrupt __attribute__((u
     if (faulty_address < vmem->base || faulty_address >= vmem->base + vmem->size) {
         //this is not the droid you are looking for
         kprintf("base: 0x%8h; size: %d;\n",  vmem->base, vmem->size);
+        goto page_fault;
+    }
+
+    if (vmem->flags & VM_MAP_PHYS) {
+        //mapped up front, nothing to back lazily
 page_fault:
-        kprintf("PAGE FAULT at 0x%8h\n", faulty_address);
+        klog_error("PAGE FAULT at 0x%8h\n", faulty_address);
         //dump_vm_map();
+        klog_flush();
         asm volatile ("hlt");
-        return;
+        return (IRQ_HANDLED);
     }
 
     physaddr_t physaddr = bitmap_find_free_page();
+    if (physaddr == 0 && heap_trim() > 0) {
+        //memory pressure: give the heap's cached blocks back and retry
+        physaddr = bitmap_find_free_page();
+    }
+
     if (physaddr == 0) {
-        //We are out of memory, so maybe try to clean stuff and retry
-        kprintf("Out Of Memory\n");
+        klog_error("Out Of Memory\n");
+        klog_flush();
         asm volatile ("hlt");
-        return;
+        return (IRQ_HANDLED);
     }
 
     flags = VM_PAGE_READ_WRITE;
@@ -399,21 +455,28 @@ page_fault:
     bitmap_mark_as_used(physaddr);
     if (map_page(physaddr, (virtaddr_t)((uint32_t)faulty_address & ~FIRST_12BITS_MASK), flags | VM_PAGE_READ_WRITE) != 0) {
         //Something went very wrong
-        kprintf("PANIC at 0x%8h\n", faulty_address);
+        klog_error("PANIC at 0x%8h\n", faulty_address);
         dump_vm_map();
+        klog_flush();
         asm volatile ("hlt");
-        return;
+        return (IRQ_HANDLED);
     }
 
-    memset((virtaddr_t)((uint32_t)faulty_address & ~FIRST_12BITS_MASK), 0, PAGE_SIZE);
+    zero_page((void *)((uint32_t)faulty_address & ~FIRST_12BITS_MASK));
     if (vmem->flags & VM_MAP_FILE && ((faulty_address - vmem->base) & ~FIRST_12BITS_MASK) < vmem->disksize) {
-        if (fat_seek(vmem->file, vmem->offset + (faulty_address - vmem->base) & ~FIRST_12BITS_MASK, SEEK_SET) != 0) {
+        //the task may sleep on the disk and vm_map change meanwhile, don't use vmem past here
+        struct file *file = vmem->file;
+        uint32_t position = vmem->offset + (faulty_address - vmem->base) & ~FIRST_12BITS_MASK;
+        uint32_t size = min(PAGE_SIZE, vmem->disksize - ((faulty_address - vmem->base) & ~FIRST_12BITS_MASK));
+
+        if (fat_seek(file, position, SEEK_SET) != 0) {
             kprintf("fat_seek error\n");
         }
-        fat_read(vmem->file, (virtaddr_t)((uint32_t)faulty_address & ~FIRST_12BITS_MASK), min(PAGE_SIZE, vmem->disksize - ((faulty_address - vmem->base) & ~FIRST_12BITS_MASK)));
+        fat_read(file, (virtaddr_t)((uint32_t)faulty_address & ~FIRST_12BITS_MASK), size);
     }
 
     map_change_permission(faulty_address, flags);
+    return (IRQ_HANDLED);
 }
 
 #define MAX_LINE_DUMP 20
@@ -435,6 +498,28 @@ int __check_ptr_userspace(const void *ptr, uint32_t len) {
     return 0;
 }
 
+//walk the vm_map entries covering the range, each one must carry flags.
+//unlike the page checks this accepts pages that are not faulted in yet
+int __check_ptr_vm_map(const void *ptr, uint32_t len, uint32_t flags) {
+    uintptr_t addr = (uintptr_t)ptr;
+    uintptr_t end = addr + len;
+
+    if (end < addr) {
+        return 1;
+    }
+
+    while (addr < end) {
+        struct vm_entry *vmem = (struct vm_entry *)bsearch_s((const void *)addr, vm_map, vm_map_size, sizeof(struct vm_entry), vm_entry_cmp, (void *)0);
+        if (vmem == (void *)0 || (vmem->flags & flags) != flags) {
+            return 1;
+        }
+
+        addr = vmem->base + vmem->size;
+    }
+
+    return 0;
+}
+
 int __check_ptr(const void *ptr, uint32_t len) {
     for (const void *page = ptr; page < ptr + len; page += PAGE_SIZE) {
         if ((get_flags(page) & VM_PAGE_PRESENT) == 0) {
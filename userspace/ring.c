@@ -0,0 +1,36 @@
+#include "ring.h"
+#include "syscall.h"
+
+DECL_SYSCALL2(ring_setup, uint32_t, uint32_t);
+DEFN_SYSCALL2(ring_setup, 72, uint32_t, uint32_t);
+DECL_SYSCALL2(ring_enter, uint32_t, uint32_t);
+DEFN_SYSCALL2(ring_enter, 73, uint32_t, uint32_t);
+
+int ring_init(struct ring *ring, uint32_t entries, uint32_t flags) {
+    int base = syscall_ring_setup(entries, flags);
+    if (base == -1) {
+        return (-1);
+    }
+
+    ring->header = (struct ring_header *)base;
+    ring->sqes = (struct ring_sqe *)(base + ring->header->sq_offset);
+    ring->cqes = (struct ring_cqe *)(base + ring->header->cq_offset);
+    ring->sq_tail = ring->header->sq_tail;
+
+    return (0);
+}
+
+//publish the sqes filled since last time; with sqpoll the kernel picks
+//them up on its own, otherwise one trap runs all of them
+int ring_submit(struct ring *ring) {
+    struct ring_header *header = ring->header;
+    uint32_t pending = ring->sq_tail - header->sq_head;
+
+    __atomic_store_n(&header->sq_tail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    if (header->flags & RING_SETUP_SQPOLL) {
+        return pending;
+    }
+
+    return syscall_ring_enter(pending, pending);
+}
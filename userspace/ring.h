@@ -0,0 +1,82 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdint.h>
+
+// Userspace side of the kernel submission/completion rings
+// (same layout as kernel/ring.h).
+
+#define RING_OP_NOP 0
+#define RING_OP_WRITE 1
+#define RING_OP_READ 2
+#define RING_OP_MMAP 3
+#define RING_OP_MUNMAP 4
+
+#define RING_SETUP_SQPOLL 0x1
+
+struct ring_header {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_offset;
+    uint32_t cq_offset;
+    uint32_t flags;
+    volatile uint32_t cq_overflow;
+    uint32_t reserved[6];
+};
+
+struct ring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t user_data;
+};
+
+struct ring_cqe {
+    uint32_t user_data;
+    int32_t res;
+};
+
+struct ring {
+    struct ring_header *header;
+    struct ring_sqe *sqes;
+    struct ring_cqe *cqes;
+    uint32_t sq_tail; //local, published by ring_submit
+};
+
+int ring_init(struct ring *ring, uint32_t entries, uint32_t flags);
+int ring_submit(struct ring *ring);
+
+//next free sqe, or 0 when the sq is full
+static inline struct ring_sqe *ring_get_sqe(struct ring *ring) {
+    struct ring_header *header = ring->header;
+
+    if (ring->sq_tail - __atomic_load_n(&header->sq_head, __ATOMIC_ACQUIRE) >= header->sq_entries) {
+        return (void *)0;
+    }
+
+    return &ring->sqes[ring->sq_tail++ & (header->sq_entries - 1)];
+}
+
+//oldest completion not seen yet, or 0
+static inline struct ring_cqe *ring_peek_cqe(struct ring *ring) {
+    struct ring_header *header = ring->header;
+    uint32_t head = header->cq_head;
+
+    if (head == __atomic_load_n(&header->cq_tail, __ATOMIC_ACQUIRE)) {
+        return (void *)0;
+    }
+
+    return &ring->cqes[head & (header->cq_entries - 1)];
+}
+
+static inline void ring_cqe_seen(struct ring *ring) {
+    __atomic_store_n(&ring->header->cq_head, ring->header->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
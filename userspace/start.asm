@@ -1,8 +1,10 @@
 bits 32
 global _start
 extern main
+extern __syscall_init
 
 _start:
+    call __syscall_init
     call main
 
     mov ebx, eax
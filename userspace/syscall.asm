@@ -0,0 +1,50 @@
+bits 32
+section .text
+
+; int __syscall_int80(int no, int a1, int a2, int a3, int a4, int a5)
+global __syscall_int80
+__syscall_int80:
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp + 16]
+    mov ebx, [esp + 20]
+    mov ecx, [esp + 24]
+    mov edx, [esp + 28]
+    mov esi, [esp + 32]
+    mov edi, [esp + 36]
+    int 0x80
+    pop edi
+    pop esi
+    pop ebx
+    ret
+
+; same with sysenter, the kernel finds ecx, edx and where to come back
+; on the stack pointed by ebp (see kernel/sysenter.asm)
+global __syscall_sysenter
+__syscall_sysenter:
+    push ebx
+    push esi
+    push edi
+    push ebp
+    mov eax, [esp + 20]
+    mov ebx, [esp + 24]
+    mov ecx, [esp + 28]
+    mov edx, [esp + 32]
+    mov esi, [esp + 36]
+    mov edi, [esp + 40]
+    push ecx
+    push edx
+    push ebp
+    push .return
+    mov ebp, esp
+    sysenter
+.return:
+    pop ebp
+    pop edx
+    pop ecx
+    pop ebp
+    pop edi
+    pop esi
+    pop ebx
+    ret
@@ -0,0 +1,47 @@
+#include "syscall.h"
+
+#define EFLAGS_ID (1 << 21)
+#define CPUID_EDX_SEP (1 << 11)
+
+int (*__syscall)(int no, int a1, int a2, int a3, int a4, int a5) = __syscall_int80;
+
+static int cpu_has_sysenter(void) {
+    unsigned int before, after;
+    unsigned int eax, ebx, ecx, edx;
+
+    //no cpuid when eflags.id can't be flipped
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "mov %0, %1\n"
+                 "xor %2, %1\n"
+                 "push %1\n"
+                 "popf\n"
+                 "pushf\n"
+                 "pop %1\n"
+                 "push %0\n"
+                 "popf" : "=&r"(before), "=&r"(after) : "i"(EFLAGS_ID));
+    if (((before ^ after) & EFLAGS_ID) == 0) {
+        return (0);
+    }
+
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    if ((edx & CPUID_EDX_SEP) == 0) {
+        return (0);
+    }
+
+    //early pentium pro report sep without having it
+    unsigned int family = (eax >> 8) & 0xF;
+    unsigned int model = (eax >> 4) & 0xF;
+    unsigned int stepping = eax & 0xF;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return (0);
+    }
+
+    return (1);
+}
+
+void __syscall_init() {
+    if (cpu_has_sysenter()) {
+        __syscall = __syscall_sysenter;
+    }
+}
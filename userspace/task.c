@@ -0,0 +1,27 @@
+#include "task.h"
+#include "syscall.h"
+
+DECL_SYSCALL1(spawn, const char *);
+DEFN_SYSCALL1(spawn, 75, const char *);
+DECL_SYSCALL2(wait, int, int *);
+DEFN_SYSCALL2(wait, 76, int, int *);
+DECL_SYSCALL0(yield);
+DEFN_SYSCALL0(yield, 77);
+DECL_SYSCALL0(getpid);
+DEFN_SYSCALL0(getpid, 78);
+
+int spawn(const char *path) {
+    return syscall_spawn(path);
+}
+
+int wait(int pid, int *status) {
+    return syscall_wait(pid, status);
+}
+
+int yield() {
+    return syscall_yield();
+}
+
+int getpid() {
+    return syscall_getpid();
+}
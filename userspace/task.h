@@ -0,0 +1,14 @@
+#ifndef _TASK_H
+#define _TASK_H
+
+#include <stdint.h>
+
+// Tasks: spawn a program from the filesystem ("DIR/PROG"), wait for it.
+// All of them share the address space, see kernel/task.h.
+
+int spawn(const char *path);
+int wait(int pid, int *status); //pid -1: any child
+int yield(void);
+int getpid(void);
+
+#endif
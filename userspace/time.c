@@ -0,0 +1,101 @@
+#include "time.h"
+
+#define NSEC_PER_SEC 1000000000
+
+static const struct vdso_data *vdso = (const struct vdso_data *)VDSO_USER_ADDR;
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+//no libgcc here either: 64 by 32 bit division with two divl
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder) {
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend;
+    uint32_t q_high = high / divisor;
+    uint32_t q_low, rem;
+
+    high %= divisor;
+    asm("divl %4" : "=a"(q_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+    *remainder = rem;
+
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+static inline uint64_t mul_u64_u32_shr(uint64_t value, uint32_t mult, uint32_t shift) {
+    uint64_t low = (uint64_t)(uint32_t)value * mult;
+    uint64_t high = (uint64_t)(uint32_t)(value >> 32) * mult;
+
+    return (low >> shift) + (shift < 32 ? high << (32 - shift) : high >> (shift - 32));
+}
+
+//seqlock read side: retry while the kernel is in the middle of an update
+static int vdso_read(uint64_t *monotonic_ns, uint64_t *wall_boot_sec) {
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&vdso->seq, __ATOMIC_ACQUIRE)) & 1) {}
+
+        if ((vdso->flags & VDSO_TSC_STABLE) == 0) {
+            return (-1);
+        }
+
+        *monotonic_ns = vdso->monotonic_base_ns + mul_u64_u32_shr(rdtsc() - vdso->tsc_base, vdso->tsc_mult, vdso->tsc_shift);
+        *wall_boot_sec = vdso->wall_boot_sec;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != vdso->seq);
+
+    return (0);
+}
+
+int clock_gettime(int clock, struct timespec *ts) {
+    uint64_t ns, wall_boot_sec;
+    uint32_t nsec;
+
+    if ((clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) || vdso_read(&ns, &wall_boot_sec) != 0) {
+        return (-1);
+    }
+
+    ts->tv_sec = div_u64_rem(ns, NSEC_PER_SEC, &nsec);
+    ts->tv_nsec = nsec;
+    if (clock == CLOCK_REALTIME) {
+        ts->tv_sec += wall_boot_sec;
+    }
+
+    return (0);
+}
+
+uint64_t clock_monotonic_ns() {
+    uint64_t ns, wall_boot_sec;
+
+    if (vdso_read(&ns, &wall_boot_sec) != 0) {
+        return (0);
+    }
+
+    return ns;
+}
+
+uint32_t uptime() {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return (0);
+    }
+
+    return ts.tv_sec;
+}
+
+uint32_t cpu_count() {
+    return vdso->cpu_count;
+}
+
+uint32_t page_size() {
+    return vdso->page_size;
+}
+
+uint32_t tsc_khz() {
+    return vdso->tsc_khz;
+}
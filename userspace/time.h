@@ -0,0 +1,40 @@
+#ifndef _TIME_H
+#define _TIME_H
+
+#include <stdint.h>
+
+// Time and system information read from the kernel shared page, no syscall.
+// Layout shared with kernel/vdso.h.
+
+#define VDSO_USER_ADDR 0xBFFF0000
+#define VDSO_TSC_STABLE 0x1
+
+struct vdso_data {
+    volatile uint32_t seq;
+    uint32_t flags;
+    uint32_t tsc_mult;
+    uint32_t tsc_shift;
+    uint64_t tsc_base;
+    uint64_t monotonic_base_ns;
+    uint64_t wall_boot_sec;
+    uint32_t tsc_khz;
+    uint32_t cpu_count;
+    uint32_t page_size;
+};
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+int clock_gettime(int clock, struct timespec *ts);
+uint64_t clock_monotonic_ns(void);
+uint32_t uptime(void);
+uint32_t cpu_count(void);
+uint32_t page_size(void);
+uint32_t tsc_khz(void);
+
+#endif